@@ -0,0 +1,302 @@
+// benchmarks of the engine hot paths behind the rcpp_ exports. micro
+// cases time one call of sim_dat (rcpp_dat), sim_clin_set_state,
+// sim_clin, sim_immu, sim_immu_ppos_test and sim_logrank on one trial's
+// data; macro cases time whole trials (rcpp_dotrial) under variations of
+// the config. every case runs whole passes over a fixed set of inputs
+// until -T seconds have gone so runs are comparable.
+//
+//   orvacsim_bench [-f cfg1.yaml] [-T secs] [-c case] [-s save.csv]
+//                  [-b baseline.csv [-x tolerance]]
+//
+// -s saves the results as a baseline, -b compares with one and exits 1
+// when a case is slower than tolerance (default 1.25) times its baseline.
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+
+#include "engine.h"
+#include "cfg_yaml.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+// keeps results the compiler could otherwise drop
+static volatile double bench_sink = 0;
+
+// one benchmark. setup (untimed) prepares call k of a pass, run makes
+// the call and returns the predictive draws it used.
+struct BenchCase {
+ std::string name;
+ int per_pass;
+ std::function<void(int)> setup;
+ std::function<int(int)> run;
+};
+
+struct BenchRes {
+ std::string name;
+ long long calls = 0;
+ double ns_per_call = 0;
+ double draws_per_sec = 0;
+ double calls_per_sec = 0;
+};
+
+static BenchRes bench_run(const BenchCase& b, const double secs){
+
+ BenchRes r;
+ r.name = b.name;
+ long long draws = 0;
+ double ns = 0;
+
+ // one untimed pass to warm the caches and workspaces
+ for(int k = 0; k < b.per_pass; k++){
+   b.setup(k);
+   b.run(k);
+ }
+ while(ns < secs * 1e9){
+   for(int k = 0; k < b.per_pass; k++){
+     b.setup(k);
+     bench_clock::time_point t0 = bench_clock::now();
+     draws += b.run(k);
+     ns += std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+   }
+   r.calls += b.per_pass;
+ }
+ r.ns_per_call = ns / r.calls;
+ r.calls_per_sec = 1e9 * r.calls / ns;
+ r.draws_per_sec = 1e9 * draws / ns;
+ return r;
+}
+
+static std::map<std::string, double> read_baseline(const std::string& path){
+ std::map<std::string, double> base;
+ std::ifstream is(path);
+ if(!is){
+   throw std::runtime_error("cannot read baseline " + path);
+ }
+ std::string line;
+ std::getline(is, line);
+ while(std::getline(is, line)){
+   std::istringstream ss(line);
+   std::string name;
+   std::string ns;
+   if(std::getline(ss, name, ',') && std::getline(ss, ns, ',')){
+     base[name] = std::atof(ns.c_str());
+   }
+ }
+ return base;
+}
+
+static void write_results(std::ostream& os, const std::vector<BenchRes>& res){
+ os << "case,ns_per_call,calls_per_sec,draws_per_sec,calls\n";
+ for(const BenchRes& r : res){
+   os << r.name << "," << r.ns_per_call << "," << r.calls_per_sec << ","
+      << r.draws_per_sec << "," << r.calls << "\n";
+ }
+}
+
+
+// the look of the micro cases: the clin analysis at the third look past
+// nstartclin, the immu analysis at the last look within nmaxsero
+static int clin_look(const SimConfig& c){
+ int k = 0;
+ while(k < c.nlooks() - 1 && c.looks[k] < c.nstartclin) k++;
+ return std::min(k + 3, c.nlooks());
+}
+
+static int immu_look(const SimConfig& c){
+ int k = 0;
+ while(k < c.nlooks() && c.looks[k] <= c.nmaxsero) k++;
+ return std::max(k, 1);
+}
+
+// config variations of the macro cases
+struct BenchCfg {
+ std::string name;
+ SimConfig c;
+};
+
+static std::vector<BenchCfg> bench_cfgs(const YAML::Node& y0){
+
+ std::vector<BenchCfg> cfgs;
+ int nsims = 0;
+ auto add = [&](const std::string& name,
+                std::function<void(YAML::Node&, CfgOverride&)> f){
+   YAML::Node y = YAML::Clone(y0);
+   CfgOverride o;
+   o.nsims = 0;
+   o.seed = 1;
+   f(y, o);
+   cfgs.push_back({name, cfg_from_node(y, o, nsims)});
+ };
+
+ add("alt", [](YAML::Node&, CfgOverride&){});
+ add("null", [](YAML::Node& y, CfgOverride& o){
+   o.trtprobsero = y["baselineprobsero"].as<double>();
+   o.trtmedtte = y["ctl_med_tte"].as<double>();
+ });
+ add("nstop500", [](YAML::Node& y, CfgOverride&){ y["nstop"] = 500; });
+ add("draw2000", [](YAML::Node& y, CfgOverride&){ y["post_draw"] = 2000; });
+ add("looks25", [](YAML::Node&, CfgOverride& o){ o.accrual = 25; });
+ add("mc", [](YAML::Node& y, CfgOverride&){
+   y["clin_pp_analytic"] = 0;
+   y["immu_pp_enumerate"] = 0;
+ });
+ return cfgs;
+}
+
+
+int main(int argc, char** argv){
+
+ std::string cfgfile = "../../../simulations/sim_01/cfg1.yaml";
+ std::string only;
+ std::string savefile;
+ std::string basefile;
+ double secs = 0.5;
+ double tol = 1.25;
+
+ int opt;
+ while((opt = getopt(argc, argv, "f:T:c:s:b:x:h")) != -1){
+   switch(opt){
+   case 'f': cfgfile = optarg; break;
+   case 'T': secs = std::atof(optarg); break;
+   case 'c': only = optarg; break;
+   case 's': savefile = optarg; break;
+   case 'b': basefile = optarg; break;
+   case 'x': tol = std::atof(optarg); break;
+   default:
+     std::cerr << "usage: orvacsim_bench [-f cfgfile] [-T secs] [-c case] "
+                  "[-s save.csv] [-b baseline.csv [-x tolerance]]\n";
+     return opt == 'h' ? 0 : 2;
+   }
+ }
+
+ log_os = &std::cerr;
+
+ std::vector<BenchCfg> cfgs;
+ try {
+   cfgs = bench_cfgs(cfg_load(cfgfile));
+ } catch(std::exception& e){
+   std::cerr << "orvacsim_bench: " << e.what() << "\n";
+   return 1;
+ }
+
+ // micro cases run on trial 1 of the alt config, the mc variation for
+ // the draw based ones
+ const SimConfig& c = cfgs[0].c;
+ const SimConfig& cmc = cfgs.back().c;
+ const int ndat = 20;
+ std::vector<TrialData> d0(ndat);
+ for(int k = 0; k < ndat; k++){
+   sim_dat(c, Rng(c.seed, k + 1), d0[k]);
+ }
+ const int lc = clin_look(c);
+ const int li = immu_look(c);
+ TrialData d;
+ Workspace ws;
+ Workspace wsmc;
+ ws.fit(c);
+ wsmc.fit(cmc);
+ ClinTally ctally;
+ SeroTally stally;
+
+ // posterior draws and counts for the immu ppos test
+ int nobs = sim_n_obs(d0[0], li, c.interimmnths, (float)c.sero_info_delay);
+ SeroCount lnsero = sim_lnsero(d0[0], nobs);
+ arma::mat mpost(cmc.post_draw, 3);
+ sim_immu_interim_post(mpost, nobs, cmc.post_draw, lnsero,
+                       Rng(c.seed, 1).stream(STREAM_IMMU_POST, li), PP_MC_PLAIN);
+ int nimpute = std::max(2, c.looks_target[li - 1] - nobs);
+
+ std::vector<BenchCase> cases;
+ auto nop = [](int){};
+ auto fresh = [&](int k){
+   d = d0[k];
+   ctally = ClinTally();
+   stally = SeroTally();
+ };
+
+ cases.push_back({"dat", ndat, nop, [&](int k){
+   sim_dat(c, Rng(c.seed, k + 1), d);
+   return 0;
+ }});
+ cases.push_back({"clin_set_state", ndat, fresh, [&](int){
+   sim_clin_set_state(d, lc, c.max_age_fu_months, c);
+   return 0;
+ }});
+ cases.push_back({"clin", ndat, fresh, [&](int k){
+   return sim_clin(d, c, lc, k + 1, Rng(c.seed, k + 1), ctally, ws).n_draw;
+ }});
+ cases.push_back({"clin_mc", ndat, fresh, [&](int k){
+   return sim_clin(d, cmc, lc, k + 1, Rng(c.seed, k + 1), ctally, wsmc).n_draw;
+ }});
+ cases.push_back({"immu", ndat, fresh, [&](int k){
+   return sim_immu(d, c, li, Rng(c.seed, k + 1), stally, ws).n_draw;
+ }});
+ cases.push_back({"immu_mc", ndat, fresh, [&](int k){
+   return sim_immu(d, cmc, li, Rng(c.seed, k + 1), stally, wsmc).n_draw;
+ }});
+ cases.push_back({"immu_ppos_test", ndat, nop, [&](int k){
+   PposRes& r = wsmc.pp[0];
+   sim_immu_ppos_test(mpost, li, nobs, nimpute, cmc.post_draw, lnsero, cmc,
+                      Rng(c.seed, k + 1).stream(STREAM_USER, 0), na_real(),
+                      r, wsmc);
+   return r.n_draw;
+ }});
+ cases.push_back({"logrank", ndat, [&](int k){
+   fresh(k);
+   sim_clin_set_state(d, lc, c.max_age_fu_months, c);
+ }, [&](int){
+   bench_sink += sim_logrank(d, c.looks[lc - 1], std::vector<int>()).z();
+   return 0;
+ }});
+ for(const BenchCfg& bc : cfgs){
+   const SimConfig* pc = &bc.c;
+   cases.push_back({"dotrial_" + bc.name, 4, nop, [&ws, pc](int k){
+     sim_dotrial(k + 1, *pc, ws);
+     return 0;
+   }});
+ }
+
+ std::vector<BenchRes> res;
+ for(const BenchCase& b : cases){
+   if(!only.empty() && b.name.find(only) == std::string::npos) continue;
+   res.push_back(bench_run(b, secs));
+   const BenchRes& r = res.back();
+   std::fprintf(stderr, "%-22s %12.0f ns/call %10.1f calls/s %12.0f draws/s\n",
+                r.name.c_str(), r.ns_per_call, r.calls_per_sec, r.draws_per_sec);
+ }
+
+ if(!savefile.empty()){
+   std::ofstream os(savefile);
+   os.precision(10);
+   write_results(os, res);
+ } else {
+   std::cout.precision(10);
+   write_results(std::cout, res);
+ }
+
+ if(basefile.empty()) return 0;
+
+ std::map<std::string, double> base;
+ try {
+   base = read_baseline(basefile);
+ } catch(std::exception& e){
+   std::cerr << "orvacsim_bench: " << e.what() << "\n";
+   return 1;
+ }
+ int nslow = 0;
+ for(const BenchRes& r : res){
+   if(!base.count(r.name)) continue;
+   double ratio = r.ns_per_call / base[r.name];
+   bool slow = ratio > tol;
+   nslow += slow;
+   std::fprintf(stderr, "%-22s %6.2fx baseline%s\n", r.name.c_str(), ratio,
+                slow ? "  SLOWER" : "");
+ }
+ return nslow > 0 ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#ifndef ORVACSIM_CFG_YAML_H
+#define ORVACSIM_CFG_YAML_H
+
+// builds the SimConfig straight from a cfg1.yaml style file, deriving the
+// looks, accrual and per look thresholds the way sim_cfg() (sim_01/util.R)
+// does so that the command line runner and the R scripts agree on a file.
+// the overrides mirror the command line options of sim_01/main_4.R.
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <stdexcept>
+#include <yaml-cpp/yaml.h>
+#include "config.h"
+
+// command line settings that replace the file's, unset when negative
+struct CfgOverride {
+ int nsims = -1;
+ long long seed = -1;
+ int accrual = -1;
+ double delay = -1;
+ double basesero = -1;
+ double trtprobsero = -1;
+ double basemediantte = -1;
+ double trtmedtte = -1;
+};
+
+namespace cfgyaml {
+
+inline YAML::Node elem(const YAML::Node& y, const char* name){
+ YAML::Node n = y[name];
+ if(!n || n.IsNull()){
+   throw std::invalid_argument(std::string("cfg is missing ") + name);
+ }
+ return n;
+}
+
+inline double num(const YAML::Node& y, const char* name){
+ return elem(y, name).as<double>();
+}
+
+inline int integer(const YAML::Node& y, const char* name){
+ return elem(y, name).as<int>();
+}
+
+inline int int_or(const YAML::Node& y, const char* name, const int dflt){
+ YAML::Node n = y[name];
+ return n && !n.IsNull() ? n.as<int>() : dflt;
+}
+
+inline double num_or(const YAML::Node& y, const char* name, const double dflt){
+ YAML::Node n = y[name];
+ return n && !n.IsNull() ? n.as<double>() : dflt;
+}
+
+// R's seq(from, to, length.out = n)
+inline std::vector<double> seq_len_out(const double from, const double to,
+                                       const int n){
+ std::vector<double> x(std::max(n, 0));
+ for(int i = 0; i < n; i++){
+   x[i] = n == 1 ? from : from + i * (to - from) / (n - 1);
+ }
+ if(n > 1) x[n-1] = to;
+ return x;
+}
+
+inline int count_if_lt(const std::vector<int>& v, const int x){
+ int n = 0;
+ for(int a : v) if(a < x) n++;
+ return n;
+}
+
+}
+
+
+// builds and validates the config from the parsed file y. nsims is set
+// from the file (or override). without a seed in the file or override
+// one is drawn from the system.
+inline SimConfig cfg_from_node(const YAML::Node& y, const CfgOverride& o,
+                               int& nsims){
+
+ using namespace cfgyaml;
+
+ SimConfig c;
+
+ nsims = o.nsims >= 0 ? o.nsims : integer(y, "nsims");
+ if(o.seed >= 0){
+   c.seed = (uint32_t)o.seed;
+ } else if(y["seed"] && !y["seed"].IsNull()){
+   c.seed = (uint32_t)y["seed"].as<double>();
+ } else {
+   c.seed = std::random_device()();
+ }
+
+ // interims
+ int nstart = integer(y, "nstart");
+ c.nstop = integer(y, "nstop");
+ c.nmaxsero = integer(y, "nmaxsero");
+ c.nstartclin = integer(y, "nstartclin");
+ c.interim_period = num(y, "interim_period");
+ double ppip = o.accrual > 0 ? o.accrual : num(y, "people_per_interim_period");
+
+ // looks every 50 (every accrual when overridden, as main_4.R does) and
+ // always one at nstop
+ int step = o.accrual > 0 ? o.accrual : 50;
+ for(int n = nstart; n <= c.nstop; n += step) c.looks.push_back(n);
+ if(c.looks.empty() || c.looks.back() < c.nstop) c.looks.push_back(c.nstop);
+ int nlooks = c.nlooks();
+
+ c.months_per_person = c.interim_period / ppip;
+ for(int i = 0; i < nlooks; i++){
+   c.interimmnths.push_back(c.months_per_person * nstart + i * c.interim_period);
+ }
+ for(int n = nstart; n <= c.nstop; n += 50) c.looks_target.push_back(n);
+ c.looks_target.resize(nlooks, c.nstop);
+ c.sero_info_delay = o.delay >= 0 ? o.delay : num(y, "sero_info_delay");
+
+ // data generation
+ c.age_months_lwr = num(y, "age_months_lwr");
+ c.age_months_upr = num(y, "age_months_upr");
+ c.max_age_fu_months = num(y, "max_age_fu_months");
+ c.baselineprobsero = o.basesero >= 0 ? o.basesero : num(y, "baselineprobsero");
+ c.trtprobsero = o.trtprobsero >= 0 ? o.trtprobsero : num(y, "trtprobsero");
+ c.deltaserot3 = (c.trtprobsero - c.baselineprobsero) / (1 - c.baselineprobsero);
+ double ctl_med = o.basemediantte > 0 ? o.basemediantte : num(y, "ctl_med_tte");
+ double trt_med = o.trtmedtte > 0 ? o.trtmedtte : num(y, "trt_med_tte");
+ c.b0tte = std::log(2.0) / ctl_med;
+ c.b1tte = std::log(2.0) / trt_med - std::log(2.0) / ctl_med;
+
+ // conjugate posterior
+ c.post_draw = integer(y, "post_draw");
+ c.prior_gamma_a = num(y, "prior_gamma_a");
+ c.prior_gamma_b = num(y, "prior_gamma_b");
+ c.clin_pp_analytic = int_or(y, "clin_pp_analytic", 1) != 0;
+ c.immu_pp_enumerate = int_or(y, "immu_pp_enumerate", 1) != 0;
+ c.draw_threads = int_or(y, "draw_threads", 1);
+ c.pp_adaptive = int_or(y, "pp_adaptive", 0) != 0;
+ c.pp_batch = int_or(y, "pp_batch", 100);
+ c.pp_adaptive_alpha = num_or(y, "pp_adaptive_alpha", 0.001);
+ c.pp_mc = int_or(y, "pp_mc", PP_MC_PLAIN);
+ c.pp_conditional = int_or(y, "pp_conditional", 0) != 0;
+
+ // decision thresholds
+ c.post_final_thresh = num(y, "post_final_thresh");
+ c.pp_sero_fut_thresh = num(y, "pp_sero_fut_thresh");
+ c.pp_sero_sup_thresh = num(y, "pp_sero_sup_thresh");
+ c.pp_tte_fut_thresh = num(y, "pp_tte_fut_thresh");
+
+ int npre = count_if_lt(c.looks, c.nstartclin);
+ c.post_tte_win_thresh.assign(npre, num(y, "post_tte_win_thresh_start"));
+ std::vector<double> s = seq_len_out(num(y, "post_tte_win_thresh_start"),
+                                     num(y, "post_tte_win_thresh_end"),
+                                     nlooks - npre);
+ c.post_tte_win_thresh.insert(c.post_tte_win_thresh.end(), s.begin(), s.end());
+
+ c.post_sero_win_thresh = seq_len_out(num(y, "post_sero_win_thresh_start"),
+                                      num(y, "post_sero_win_thresh_end"),
+                                      count_if_lt(c.looks, c.nmaxsero + 1));
+
+ s = seq_len_out(num(y, "post_tte_sup_thresh_start"),
+                 num(y, "post_tte_sup_thresh_end"), nlooks - npre);
+ if(!s.empty()){
+   c.post_tte_sup_thresh.assign(npre, s.front());
+   c.post_tte_sup_thresh.insert(c.post_tte_sup_thresh.end(), s.begin(), s.end());
+ }
+
+ c.validate();
+
+ return c;
+}
+
+// the parsed file at path
+inline YAML::Node cfg_load(const std::string& path){
+ try {
+   return YAML::LoadFile(path);
+ } catch(YAML::Exception& e){
+   throw std::invalid_argument("cannot read " + path + ": " + e.what());
+ }
+}
+
+// as cfg_from_node for the file at path
+inline SimConfig cfg_from_yaml(const std::string& path,
+                               const CfgOverride& o, int& nsims){
+ return cfg_from_node(cfg_load(path), o, nsims);
+}
+
+#endif
@@ -0,0 +1,213 @@
+// orvacsim command line runner. reads a cfg1.yaml style config, runs the
+// trials on the R-free engine and writes one csv row per trial, the
+// columns of rcpp_dotrial_batch. with -r the trials go to a results file
+// (see resfile.h) that an interrupted run resumes from.
+//
+//   orvacsim -f cfg1.yaml [-n nsims] [-s seed] [-w workers] [-o out.csv]
+//            [-r results.bin [-k flush_every]] [-v] [-l log.bin] [-L level] [-P]
+//            [-a accrual] [-d delay] [-b basesero] [-p trtprobsero]
+//            [-m basemediantte] [-t trtmedtte]
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+
+#include "engine.h"
+#include "cfg_yaml.h"
+
+static void usage(){
+ std::cerr <<
+   "usage: orvacsim -f cfgfile [options]\n"
+   "  -f file   config file name (cfg1.yaml schema)\n"
+   "  -n int    number of simulations, default the config's nsims\n"
+   "  -s int    random seed, default the config's seed\n"
+   "  -w int    worker threads, default all cores\n"
+   "  -o file   csv output, default stdout\n"
+   "  -r file   results file to run into and resume from\n"
+   "  -k int    trials per results file chunk, default 100\n"
+   "  -v        print the event log to stderr\n"
+   "  -l file   write the binary event log to file\n"
+   "  -L level  log level, OFF FATAL WARN INFO DEBUG or TRACE, default INFO\n"
+   "  -P        print the performance counters to stderr\n"
+   "  -a int    accrual rate i.e. people_per_interim_period\n"
+   "  -d num    seroconversion information delay\n"
+   "  -b num    baseline seroconversion prob\n"
+   "  -p num    trt seroconversion prob\n"
+   "  -m num    baseline median time to med attendance (months)\n"
+   "  -t num    treatment arm median time to med attendance (months)\n";
+}
+
+// NA as R writes it
+static void write_num(std::ostream& os, const double x){
+ if(std::isnan(x)){
+   os << "NA";
+ } else {
+   os << x;
+ }
+}
+
+static void write_csv(std::ostream& os, const ResTable& t){
+ os.precision(15);
+ for(size_t j = 0; j < t.cols.size(); j++){
+   os << (j ? "," : "") << t.cols[j].name;
+ }
+ os << "\n";
+ for(int r = 0; r < t.nrow; r++){
+   size_t ki = 0;
+   size_t kd = 0;
+   for(size_t j = 0; j < t.cols.size(); j++){
+     if(j) os << ",";
+     if(t.cols[j].type == RES_INT) os << t.icol[ki++][r];
+     else write_num(os, t.dcol[kd++][r]);
+   }
+   os << "\n";
+ }
+}
+
+// the performance counters summed over the threads
+static void write_perf(std::ostream& os){
+ std::vector<PerfSlot> slots = perf_read();
+ PerfSlot tot = PerfSlot();
+ for(const PerfSlot& s : slots){
+   for(int ph = 0; ph < PF_COUNT; ph++){
+     tot.calls[ph] += s.calls[ph];
+     tot.ns[ph] += s.ns[ph];
+   }
+   for(int pc = 0; pc < PC_COUNT; pc++) tot.n[pc] += s.n[pc];
+ }
+ char buf[128];
+ os << "phase            calls        sec      ns/call   (" << slots.size()
+    << " threads)\n";
+ for(int ph = 0; ph < PF_COUNT; ph++){
+   std::snprintf(buf, sizeof buf, "%-12s %9llu %10.3f %12.0f\n",
+                 perf_phase_name(ph), (unsigned long long)tot.calls[ph],
+                 tot.ns[ph] * 1e-9,
+                 tot.calls[ph] ? (double)tot.ns[ph] / tot.calls[ph] : 0.0);
+   os << buf;
+ }
+ for(int pc = 0; pc < PC_COUNT; pc++){
+   std::snprintf(buf, sizeof buf, "%-12s %12llu\n", perf_counter_name(pc),
+                 (unsigned long long)tot.n[pc]);
+   os << buf;
+ }
+}
+
+int main(int argc, char** argv){
+
+ std::string cfgfile;
+ std::string outfile;
+ std::string resfile;
+ CfgOverride o;
+ int nthreads = 0;
+ int flush_every = 100;
+ bool verbose = false;
+ std::string logfile;
+ int level = LOG_INFO;
+ bool perf = false;
+
+ int opt;
+ while((opt = getopt(argc, argv, "f:n:s:w:o:r:k:vl:L:Pa:d:b:p:m:t:h")) != -1){
+   switch(opt){
+   case 'f': cfgfile = optarg; break;
+   case 'n': o.nsims = std::atoi(optarg); break;
+   case 's': o.seed = std::atoll(optarg); break;
+   case 'w': nthreads = std::atoi(optarg); break;
+   case 'o': outfile = optarg; break;
+   case 'r': resfile = optarg; break;
+   case 'k': flush_every = std::atoi(optarg); break;
+   case 'v': verbose = true; break;
+   case 'l': logfile = optarg; break;
+   case 'L': level = log_level_from_name(optarg); break;
+   case 'P': perf = true; break;
+   case 'a': o.accrual = std::atoi(optarg); break;
+   case 'd': o.delay = std::atof(optarg); break;
+   case 'b': o.basesero = std::atof(optarg); break;
+   case 'p': o.trtprobsero = std::atof(optarg); break;
+   case 'm': o.basemediantte = std::atof(optarg); break;
+   case 't': o.trtmedtte = std::atof(optarg); break;
+   default:
+     usage();
+     return opt == 'h' ? 0 : 2;
+   }
+ }
+ if(cfgfile.empty() || optind < argc){
+   usage();
+   return 2;
+ }
+ if(flush_every < 1){
+   std::cerr << "orvacsim: -k must be at least 1\n";
+   return 2;
+ }
+ if(level < 0){
+   std::cerr << "orvacsim: unknown log level\n";
+   return 2;
+ }
+
+ log_os = &std::cerr;
+
+ SimConfig c;
+ int nsims = 0;
+ try {
+   c = cfg_from_yaml(cfgfile, o, nsims);
+ } catch(std::exception& e){
+   std::cerr << "orvacsim: " << e.what() << "\n";
+   return 1;
+ }
+ if(nthreads < 1){
+#ifdef _OPENMP
+   nthreads = omp_get_num_procs();
+#else
+   nthreads = 1;
+#endif
+ }
+ // the log drains on its own thread, to the file or else the console
+ std::unique_ptr<LogSink> sink;
+ try {
+   if(!logfile.empty()){
+     sink.reset(new LogFileSink(logfile));
+   } else if(verbose){
+     sink.reset(new LogTextSink(std::cerr));
+   }
+ } catch(std::exception& e){
+   std::cerr << "orvacsim: " << e.what() << "\n";
+   return 1;
+ }
+ if(sink) log_start(sink.get(), level, true);
+ perf_enable(perf);
+
+ ResTable t;
+ try {
+   if(!resfile.empty()){
+     int nrun = sim_batch_file(c, nsims, nthreads, resfile, flush_every);
+     if(verbose) std::cerr << "orvacsim: ran " << nrun << " trials\n";
+     t = res_read(resfile);
+   } else {
+     std::vector<int> idx;
+     for(int i = 1; i <= nsims; i++) idx.push_back(i);
+     std::vector<TrialResult> res;
+     sim_trials(trial_tasks(c, idx), res, nthreads);
+     t = result_table(res);
+   }
+ } catch(std::exception& e){
+   log_stop();
+   std::cerr << "orvacsim: " << e.what() << "\n";
+   return 1;
+ }
+ log_stop();
+ if(perf) write_perf(std::cerr);
+
+ if(!resfile.empty() && outfile.empty()) return 0;
+ if(outfile.empty()){
+   write_csv(std::cout, t);
+   return 0;
+ }
+ std::ofstream os(outfile);
+ write_csv(os, t);
+ if(!os){
+   std::cerr << "orvacsim: cannot write " << outfile << "\n";
+   return 1;
+ }
+ return 0;
+}
@@ -19,6 +19,164 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_dotrial_batch
+Rcpp::List rcpp_dotrial_batch(const int nsims, const Rcpp::List& cfg, const int nthreads);
+RcppExport SEXP _orvacsim_rcpp_dotrial_batch(SEXP nsimsSEXP, SEXP cfgSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const int >::type nsims(nsimsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dotrial_batch(nsims, cfg, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_dotrial_batch_file
+int rcpp_dotrial_batch_file(const int nsims, const Rcpp::List& cfg, const int nthreads, const std::string& path, const int flush_every);
+RcppExport SEXP _orvacsim_rcpp_dotrial_batch_file(SEXP nsimsSEXP, SEXP cfgSEXP, SEXP nthreadsSEXP, SEXP pathSEXP, SEXP flush_everySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const int >::type nsims(nsimsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const int >::type flush_every(flush_everySEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dotrial_batch_file(nsims, cfg, nthreads, path, flush_every));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_read_results
+Rcpp::List rcpp_read_results(const std::string& path);
+RcppExport SEXP _orvacsim_rcpp_read_results(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_results(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_dotrial_grid
+Rcpp::List rcpp_dotrial_grid(const int nsims, const Rcpp::List& cfg, const Rcpp::List& grid, const int nthreads);
+RcppExport SEXP _orvacsim_rcpp_dotrial_grid(SEXP nsimsSEXP, SEXP cfgSEXP, SEXP gridSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const int >::type nsims(nsimsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type grid(gridSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dotrial_grid(nsims, cfg, grid, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_dotrial_thresh
+Rcpp::List rcpp_dotrial_thresh(const int nsims, const Rcpp::List& cfg, const Rcpp::List& thresh, const int nthreads);
+RcppExport SEXP _orvacsim_rcpp_dotrial_thresh(SEXP nsimsSEXP, SEXP cfgSEXP, SEXP threshSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const int >::type nsims(nsimsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type thresh(threshSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_dotrial_thresh(nsims, cfg, thresh, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_trace_file
+int rcpp_trace_file(const int nsims, const Rcpp::List& cfg, const int nthreads, const std::string& path);
+RcppExport SEXP _orvacsim_rcpp_trace_file(SEXP nsimsSEXP, SEXP cfgSEXP, SEXP nthreadsSEXP, SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const int >::type nsims(nsimsSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_trace_file(nsims, cfg, nthreads, path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_trace_replay
+Rcpp::List rcpp_trace_replay(const std::string& path, const Rcpp::List& cfg, const Rcpp::List& rules);
+RcppExport SEXP _orvacsim_rcpp_trace_replay(SEXP pathSEXP, SEXP cfgSEXP, SEXP rulesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type rules(rulesSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_trace_replay(path, cfg, rules));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_read_trace
+Rcpp::List rcpp_read_trace(const std::string& path);
+RcppExport SEXP _orvacsim_rcpp_read_trace(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_trace(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_log
+void rcpp_log(const std::string& path, const std::string& level);
+RcppExport SEXP _orvacsim_rcpp_log(SEXP pathSEXP, SEXP levelSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type level(levelSEXP);
+    rcpp_log(path, level);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_log_close
+void rcpp_log_close();
+RcppExport SEXP _orvacsim_rcpp_log_close() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_log_close();
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_read_log
+Rcpp::List rcpp_read_log(const std::string& path);
+RcppExport SEXP _orvacsim_rcpp_read_log(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_log(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_perf_enable
+bool rcpp_perf_enable(const bool on);
+RcppExport SEXP _orvacsim_rcpp_perf_enable(SEXP onSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const bool >::type on(onSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_perf_enable(on));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_perf_counters
+Rcpp::List rcpp_perf_counters(const bool reset);
+RcppExport SEXP _orvacsim_rcpp_perf_counters(SEXP resetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const bool >::type reset(resetSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_perf_counters(reset));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_dat
 arma::mat rcpp_dat(const Rcpp::List& cfg);
 RcppExport SEXP _orvacsim_rcpp_dat(SEXP cfgSEXP) {
@@ -59,6 +217,33 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_clin_suffstat
+Rcpp::List rcpp_clin_suffstat(const arma::mat& d, const int look, const double fu, const Rcpp::List& cfg);
+RcppExport SEXP _orvacsim_rcpp_clin_suffstat(SEXP dSEXP, SEXP lookSEXP, SEXP fuSEXP, SEXP cfgSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type d(dSEXP);
+    Rcpp::traits::input_parameter< const int >::type look(lookSEXP);
+    Rcpp::traits::input_parameter< const double >::type fu(fuSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_clin_suffstat(d, look, fu, cfg));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_clin_tally
+Rcpp::List rcpp_clin_tally(arma::mat& d, const Rcpp::IntegerVector& looks, const Rcpp::List& cfg);
+RcppExport SEXP _orvacsim_rcpp_clin_tally(SEXP dSEXP, SEXP looksSEXP, SEXP cfgSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< arma::mat& >::type d(dSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type looks(looksSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_clin_tally(d, looks, cfg));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_immu
 Rcpp::List rcpp_immu(const arma::mat& d, const Rcpp::List& cfg, const int look);
 RcppExport SEXP _orvacsim_rcpp_immu(SEXP dSEXP, SEXP cfgSEXP, SEXP lookSEXP) {
@@ -174,6 +359,20 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_logrank_strat
+Rcpp::List rcpp_logrank_strat(const arma::mat& d, const int look, const Rcpp::IntegerVector& strata, const Rcpp::List& cfg);
+RcppExport SEXP _orvacsim_rcpp_logrank_strat(SEXP dSEXP, SEXP lookSEXP, SEXP strataSEXP, SEXP cfgSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type d(dSEXP);
+    Rcpp::traits::input_parameter< const int >::type look(lookSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::IntegerVector& >::type strata(strataSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List& >::type cfg(cfgSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_logrank_strat(d, look, strata, cfg));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_gamma
 arma::vec rcpp_gamma(const int n, const double a, const double b);
 RcppExport SEXP _orvacsim_rcpp_gamma(SEXP nSEXP, SEXP aSEXP, SEXP bSEXP) {
@@ -190,9 +389,24 @@ END_RCPP
 
 static const R_CallMethodDef CallEntries[] = {
     {"_orvacsim_rcpp_dotrial", (DL_FUNC) &_orvacsim_rcpp_dotrial, 3},
+    {"_orvacsim_rcpp_dotrial_batch", (DL_FUNC) &_orvacsim_rcpp_dotrial_batch, 3},
+    {"_orvacsim_rcpp_dotrial_batch_file", (DL_FUNC) &_orvacsim_rcpp_dotrial_batch_file, 5},
+    {"_orvacsim_rcpp_read_results", (DL_FUNC) &_orvacsim_rcpp_read_results, 1},
+    {"_orvacsim_rcpp_dotrial_grid", (DL_FUNC) &_orvacsim_rcpp_dotrial_grid, 4},
+    {"_orvacsim_rcpp_dotrial_thresh", (DL_FUNC) &_orvacsim_rcpp_dotrial_thresh, 4},
+    {"_orvacsim_rcpp_trace_file", (DL_FUNC) &_orvacsim_rcpp_trace_file, 4},
+    {"_orvacsim_rcpp_trace_replay", (DL_FUNC) &_orvacsim_rcpp_trace_replay, 3},
+    {"_orvacsim_rcpp_read_trace", (DL_FUNC) &_orvacsim_rcpp_read_trace, 1},
+    {"_orvacsim_rcpp_log", (DL_FUNC) &_orvacsim_rcpp_log, 2},
+    {"_orvacsim_rcpp_log_close", (DL_FUNC) &_orvacsim_rcpp_log_close, 0},
+    {"_orvacsim_rcpp_read_log", (DL_FUNC) &_orvacsim_rcpp_read_log, 1},
+    {"_orvacsim_rcpp_perf_enable", (DL_FUNC) &_orvacsim_rcpp_perf_enable, 1},
+    {"_orvacsim_rcpp_perf_counters", (DL_FUNC) &_orvacsim_rcpp_perf_counters, 1},
     {"_orvacsim_rcpp_dat", (DL_FUNC) &_orvacsim_rcpp_dat, 1},
     {"_orvacsim_rcpp_clin", (DL_FUNC) &_orvacsim_rcpp_clin, 4},
     {"_orvacsim_rcpp_clin_set_state", (DL_FUNC) &_orvacsim_rcpp_clin_set_state, 5},
+    {"_orvacsim_rcpp_clin_suffstat", (DL_FUNC) &_orvacsim_rcpp_clin_suffstat, 4},
+    {"_orvacsim_rcpp_clin_tally", (DL_FUNC) &_orvacsim_rcpp_clin_tally, 3},
     {"_orvacsim_rcpp_immu", (DL_FUNC) &_orvacsim_rcpp_immu, 3},
     {"_orvacsim_rcpp_n_obs", (DL_FUNC) &_orvacsim_rcpp_n_obs, 5},
     {"_orvacsim_rcpp_lnsero", (DL_FUNC) &_orvacsim_rcpp_lnsero, 2},
@@ -201,6 +415,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"_orvacsim_rcpp_immu_ppos_test", (DL_FUNC) &_orvacsim_rcpp_immu_ppos_test, 8},
     {"_orvacsim_rcpp_outer", (DL_FUNC) &_orvacsim_rcpp_outer, 3},
     {"_orvacsim_rcpp_logrank", (DL_FUNC) &_orvacsim_rcpp_logrank, 3},
+    {"_orvacsim_rcpp_logrank_strat", (DL_FUNC) &_orvacsim_rcpp_logrank_strat, 4},
     {"_orvacsim_rcpp_gamma", (DL_FUNC) &_orvacsim_rcpp_gamma, 3},
     {NULL, NULL, 0}
 };
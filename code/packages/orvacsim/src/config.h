@@ -0,0 +1,260 @@
+#ifndef ORVACSIM_CONFIG_H
+#define ORVACSIM_CONFIG_H
+
+// typed simulation config. built once from the list produced by sim_cfg()
+// (sim_01/util.R), or by cli/cfg_yaml.h from the yaml file itself, and
+// passed by reference through the engine so that no R object is touched
+// while a trial runs.
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+// sampling of the monte carlo predictive draws, see qmc.h
+#define PP_MC_PLAIN       0
+#define PP_MC_ANTITHETIC  1
+#define PP_MC_SOBOL       2
+#define PP_MC_HALTON      3
+
+struct SimConfig {
+
+ uint32_t seed = 1;
+
+ // interims
+ int nstop = 0;
+ int nmaxsero = 0;
+ int nstartclin = 0;
+ std::vector<int> looks;            // number enrolled at each look
+ std::vector<int> looks_target;     // number enrolled if accrual on target
+ std::vector<double> interimmnths;  // month at which each look occurs
+ double months_per_person = 0;
+ double sero_info_delay = 0;
+ // months between looks, optional. only needed to vary the accrual rate
+ // through set_axis("people_per_interim_period", ...)
+ double interim_period = 0;
+
+ // data generation
+ double age_months_lwr = 0;
+ double age_months_upr = 0;
+ double max_age_fu_months = 0;
+ double baselineprobsero = 0;
+ double trtprobsero = 0;
+ double deltaserot3 = 0;
+ double b0tte = 0;
+ double b1tte = 0;
+
+ // conjugate posterior
+ int post_draw = 0;
+ double prior_gamma_a = 0;
+ double prior_gamma_b = 0;
+ // clinical predictive probabilities from the closed form gamma ratio
+ // tail (1) or from post_draw monte carlo draws (0)
+ bool clin_pp_analytic = true;
+ // immu predictive probabilities by enumerating the beta-binomial
+ // predictive counts (1) or by post_draw binomial draws (0)
+ bool immu_pp_enumerate = true;
+ // threads for the predictive draws within a single analysis, results
+ // are the same for any value. no effect inside rcpp_dotrial_batch
+ // workers as nested parallel regions run on one thread.
+ int draw_threads = 1;
+ // run the predictive draws in batches of pp_batch and stop once the
+ // decision they feed is settled, at error rate pp_adaptive_alpha per
+ // decision split over its checks (see seqmc.h). when off all post_draw draws are used.
+ bool pp_adaptive = false;
+ int pp_batch = 100;
+ double pp_adaptive_alpha = 0.001;
+ // variance reduction for the monte carlo predictive draws, one of
+ // PP_MC_*. pp_conditional replaces the clin posterior ratio draws
+ // (clin_pp_analytic 0) by their expectation given lambda1.
+ int pp_mc = PP_MC_PLAIN;
+ bool pp_conditional = false;
+
+ // decision thresholds
+ double post_final_thresh = 0;
+ double pp_sero_fut_thresh = 0;
+ double pp_sero_sup_thresh = 0;
+ double pp_tte_fut_thresh = 0;
+ std::vector<double> post_tte_sup_thresh;
+ std::vector<double> post_tte_win_thresh;
+ std::vector<double> post_sero_win_thresh;
+
+ int nlooks() const { return (int)looks.size(); }
+
+ // fnv-1a hash of every field that changes the simulated trials other
+ // than the seed, used to tie a results file to its design (resfile.h).
+ // draw_threads is left out as it does not change the results. without
+ // rules it also leaves out what a trace replay may vary (nmaxsero,
+ // nstartclin and the stopping thresholds, see rcpp_trace_replay). a
+ // field added above that changes the results must be added here too.
+ uint64_t result_hash(const bool rules = true) const {
+   uint64_t h = 14695981039346656037ull;
+   auto bytes = [&h](const void* p, const size_t n){
+     const unsigned char* c = (const unsigned char*)p;
+     for(size_t k = 0; k < n; k++){
+       h ^= c[k];
+       h *= 1099511628211ull;
+     }
+   };
+   auto i = [&bytes](const int64_t x){ bytes(&x, sizeof(x)); };
+   auto d = [&bytes](const double x){ bytes(&x, sizeof(x)); };
+   auto iv = [&i](const std::vector<int>& v){
+     i((int64_t)v.size());
+     for(int x : v) i(x);
+   };
+   auto dv = [&i, &d](const std::vector<double>& v){
+     i((int64_t)v.size());
+     for(double x : v) d(x);
+   };
+   i(nstop);
+   if(rules){
+     i(nmaxsero); i(nstartclin);
+     d(post_final_thresh); d(pp_sero_fut_thresh); d(pp_sero_sup_thresh);
+     d(pp_tte_fut_thresh); dv(post_tte_sup_thresh);
+   }
+   iv(looks); iv(looks_target); dv(interimmnths);
+   d(months_per_person); d(sero_info_delay); d(interim_period);
+   d(age_months_lwr); d(age_months_upr); d(max_age_fu_months);
+   d(baselineprobsero); d(trtprobsero); d(deltaserot3);
+   d(b0tte); d(b1tte);
+   i(post_draw); d(prior_gamma_a); d(prior_gamma_b);
+   i(clin_pp_analytic); i(immu_pp_enumerate);
+   i(pp_adaptive); i(pp_batch); d(pp_adaptive_alpha);
+   i(pp_mc); i(pp_conditional);
+   dv(post_tte_win_thresh); dv(post_sero_win_thresh);
+   return h;
+ }
+
+ // sets one axis of a scenario grid (rcpp_dotrial_grid) to x along with
+ // whatever sim_cfg() derives from it. the per look threshold vectors
+ // take x at every look. call validate() once all axes are set.
+ void set_axis(const std::string& name, const double x){
+   if(name == "trtprobsero" || name == "baselineprobsero"){
+     (name == "trtprobsero" ? trtprobsero : baselineprobsero) = x;
+     deltaserot3 = (trtprobsero - baselineprobsero) / (1 - baselineprobsero);
+   } else if(name == "b0tte"){
+     b0tte = x;
+   } else if(name == "b1tte"){
+     b1tte = x;
+   } else if(name == "people_per_interim_period"){
+     if(interim_period <= 0){
+       fail("people_per_interim_period needs interim_period in cfg");
+     }
+     if(x <= 0){
+       fail("people_per_interim_period must be positive");
+     }
+     // the looks keep their sizes, the first look moves with the time
+     // taken to enrol looks[0] and the rest follow it
+     double mpp = interim_period / x;
+     for(double& m : interimmnths){
+       m += (mpp - months_per_person) * looks[0];
+     }
+     months_per_person = mpp;
+   } else if(name == "sero_info_delay"){
+     sero_info_delay = x;
+   } else if(name == "nmaxsero"){
+     nmaxsero = axis_int(name, x);
+   } else if(name == "nstartclin"){
+     nstartclin = axis_int(name, x);
+   } else if(name == "post_draw"){
+     post_draw = axis_int(name, x);
+   } else if(name == "post_final_thresh"){
+     post_final_thresh = x;
+   } else if(name == "pp_sero_fut_thresh"){
+     pp_sero_fut_thresh = x;
+   } else if(name == "pp_sero_sup_thresh"){
+     pp_sero_sup_thresh = x;
+   } else if(name == "pp_tte_fut_thresh"){
+     pp_tte_fut_thresh = x;
+   } else if(name == "post_tte_sup_thresh"){
+     std::fill(post_tte_sup_thresh.begin(), post_tte_sup_thresh.end(), x);
+   } else if(name == "post_tte_win_thresh"){
+     std::fill(post_tte_win_thresh.begin(), post_tte_win_thresh.end(), x);
+   } else if(name == "post_sero_win_thresh"){
+     std::fill(post_sero_win_thresh.begin(), post_sero_win_thresh.end(), x);
+   } else {
+     fail(name + " cannot be used as a grid axis");
+   }
+ }
+
+ // throws std::invalid_argument describing the first problem found
+ void validate() const {
+   int n = nlooks();
+   if(n == 0){
+     fail("looks is empty");
+   }
+   if((int)interimmnths.size() != n){
+     fail("interimmnths must have one entry per look");
+   }
+   if((int)looks_target.size() != n){
+     fail("looks_target must have one entry per look");
+   }
+   if((int)post_tte_sup_thresh.size() != n){
+     fail("post_tte_sup_thresh must have one entry per look");
+   }
+   if((int)post_tte_win_thresh.size() != n){
+     fail("post_tte_win_thresh must have one entry per look");
+   }
+   for(int i = 1; i < n; i++){
+     if(looks[i] <= looks[i-1] || interimmnths[i] <= interimmnths[i-1]){
+       fail("looks and interimmnths must be increasing");
+     }
+   }
+   if(looks[0] < 1){
+     fail("looks must be positive");
+   }
+   if(looks[0] > nmaxsero){
+     fail("the first look must be within nmaxsero");
+   }
+   if(nstop != looks[n-1]){
+     fail("nstop must equal the last look");
+   }
+   int nsero = (int)std::count_if(looks.begin(), looks.end(),
+                                  [this](int x){ return x <= nmaxsero; });
+   if((int)post_sero_win_thresh.size() < nsero){
+     fail("post_sero_win_thresh must have an entry for each look up to nmaxsero");
+   }
+   if(post_draw < 1){
+     fail("post_draw must be at least 1");
+   }
+   if(draw_threads < 1){
+     fail("draw_threads must be at least 1");
+   }
+   if(pp_batch < 1){
+     fail("pp_batch must be at least 1");
+   }
+   if(!(pp_adaptive_alpha > 0 && pp_adaptive_alpha < 0.5)){
+     fail("pp_adaptive_alpha must be in (0, 0.5)");
+   }
+   if(pp_mc < PP_MC_PLAIN || pp_mc > PP_MC_HALTON){
+     fail("pp_mc must be 0 (plain), 1 (antithetic), 2 (sobol) or 3 (halton)");
+   }
+   if(months_per_person <= 0){
+     fail("months_per_person must be positive");
+   }
+   if(b0tte <= 0 || b0tte + b1tte <= 0){
+     fail("b0tte and b0tte + b1tte must be positive");
+   }
+   if(prior_gamma_a <= 0 || prior_gamma_b <= 0){
+     fail("prior_gamma_a and prior_gamma_b must be positive");
+   }
+   if(age_months_upr < age_months_lwr){
+     fail("age_months_upr must not be less than age_months_lwr");
+   }
+ }
+
+private:
+ static void fail(const std::string& msg){
+   throw std::invalid_argument("invalid cfg: " + msg);
+ }
+
+ static int axis_int(const std::string& name, const double x){
+   if(x != (double)(int)x){
+     fail(name + " must be a whole number");
+   }
+   return (int)x;
+ }
+};
+
+#endif
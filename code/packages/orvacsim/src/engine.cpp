@@ -0,0 +1,1726 @@
+// the R-free simulation engine, see engine.h
+
+#include "engine.h"
+
+std::ostream* log_os = &std::cout;
+void (*user_interrupt)() = nullptr;
+
+
+// number of rows of column j of m above x, arma::find would allocate
+// the indices
+inline int col_count_gt(const arma::mat& m, const int j, const double x){
+ int n = 0;
+ for(arma::uword i = 0; i < m.n_rows; i++){
+   n += m(i, j) > x;
+ }
+ return n;
+}
+
+// the number of workers run_tasks uses for nthreads
+inline int task_workers(const int nthreads){
+#ifdef _OPENMP
+ return std::max(1, nthreads);
+#else
+ return 1;
+#endif
+}
+
+// the calling thread's number in the innermost parallel region, so the
+// index of the worker within run_tasks or of the draw thread within the
+// predictive draws. 0 outside a parallel region.
+inline int thread_num(){
+#ifdef _OPENMP
+ return omp_get_thread_num();
+#else
+ return 0;
+#endif
+}
+
+// calls f(i) for i in 0..n-1 on up to nthreads workers, each taking the
+// next i as it finishes. user_interrupt is polled about every 100 tasks
+// on the calling thread, which is worker 0 of the parallel region.
+// exceptions must not escape the parallel region, the first is kept, the
+// tasks not yet started are skipped and it is rethrown on the main
+// thread (std::exception as std::runtime_error, anything else such as
+// R's interrupt as is).
+template <typename F>
+void run_tasks(const int n, const int nthreads, F f){
+
+ int nworkers = task_workers(nthreads);
+
+ if(nworkers == 1){
+   for(int i = 0; i < n; i++){
+     f(i);
+     if(i % 100 == 0 && user_interrupt) user_interrupt();
+   }
+ } else {
+   std::string err;
+   std::exception_ptr other;
+   std::atomic<bool> stop(false);
+   // worker 0 runs about one task in nworkers
+   int poll_every = std::max(1, 100 / nworkers);
+   int ndone0 = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nworkers)
+#endif
+   for(int i = 0; i < n; i++){
+     if(stop.load(std::memory_order_relaxed)) continue;
+     try {
+       f(i);
+       if(user_interrupt && thread_num() == 0 && ++ndone0 % poll_every == 0){
+         user_interrupt();
+       }
+     } catch(std::exception& e){
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+       if(err.empty() && !other) err = e.what();
+       stop.store(true, std::memory_order_relaxed);
+     } catch(...){
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+       if(err.empty() && !other) other = std::current_exception();
+       stop.store(true, std::memory_order_relaxed);
+     }
+   }
+   if(other){
+     std::rethrow_exception(other);
+   }
+   if(!err.empty()){
+     throw std::runtime_error(err);
+   }
+ }
+}
+
+
+
+
+class Trial {
+private:
+ int stop_ven_samp = 0;
+ int stop_immu_fut = 0;
+ int stop_clin_fut = 0;
+ int stop_clin_sup = 0;
+ int inconclu = 0;
+ int nmaxsero = 200;
+ int nstartclin = 200;
+ int immu_ss = 0;
+ int clin_ss = 0;
+
+ bool i_final_win = 0;
+ bool c_final_win = 0;
+
+public:
+ Trial(const SimConfig& cfg)
+ {
+   nmaxsero = cfg.nmaxsero;
+   nstartclin = cfg.nstartclin;
+ }
+ Trial(const SimConfig& cfg, int vstop, int ifut, int cfut, int csup, int inc)
+ {
+   nmaxsero = cfg.nmaxsero;
+   nstartclin = cfg.nstartclin;
+   stop_ven_samp = vstop;
+   stop_immu_fut = ifut;
+   stop_clin_fut = cfut;
+   stop_clin_sup = csup;
+   inconclu = inc;
+ }
+ int maxsero();
+ int startclin_at_n();
+ bool do_immu(int n_current);
+ bool do_clin(int n_current);
+ int is_v_samp_stopped(){return stop_ven_samp;}
+ int is_immu_fut(){return stop_immu_fut;}
+ int is_clin_fut(){return stop_clin_fut;}
+ int is_clin_sup(){return stop_clin_sup;}
+ int is_inconclusive(){return inconclu;}
+ int getnmaxsero(){return nmaxsero;}
+ int getnstartclin(){return nstartclin;}
+ int get_immu_ss(){return immu_ss;}
+ int get_clin_ss(){return clin_ss;}
+ int immu_final(){return i_final_win;}
+ int clin_final(){return c_final_win;}
+ void immu_stopv();
+ void immu_fut();
+ void clin_fut();
+ void clin_sup();
+ void inconclusive();
+ void immu_set_ss(int n);
+ void clin_set_ss(int n);
+ void immu_final_win(bool won);
+ void clin_final_win(bool won);
+};
+int Trial::maxsero(){
+ return nmaxsero;
+}
+int Trial::startclin_at_n(){
+ return nstartclin;
+}
+bool Trial::do_immu(int n_current){
+ if(stop_ven_samp == 1){
+   return false;
+ }
+ if(n_current > nmaxsero){
+   return false;
+ }
+ if(stop_immu_fut == 1){
+   return false;
+ }
+ if(stop_clin_fut == 1){
+   return false;
+ }
+ if(stop_clin_sup == 1){
+   return false;
+ }
+ return true;
+}
+bool Trial::do_clin(int n_current){
+
+ if(n_current < nstartclin){
+   return false;
+ }
+ if(stop_clin_fut == 1){
+   return false;
+ }
+ if(stop_clin_sup == 1){
+   return false;
+ }
+ if(stop_immu_fut == 1){
+   return false;
+ }
+ return true;
+}
+void Trial::immu_stopv(){stop_ven_samp = 1;}
+void Trial::immu_fut(){
+ stop_immu_fut = 1;
+ return;
+}
+void Trial::clin_fut(){stop_clin_fut = 1;}
+void Trial::clin_sup(){stop_clin_sup = 1;}
+void Trial::inconclusive(){inconclu = 1;}
+void Trial::immu_set_ss(int n){immu_ss = n;}
+void Trial::clin_set_ss(int n){clin_ss = n;}
+void Trial::immu_final_win(bool won){
+ i_final_win = won;
+}
+void Trial::clin_final_win(bool won){
+ c_final_win = won;
+}
+
+
+// the traces (TrialAnalysis::trace) of trials idx0 + 1, ..., idx0 + n
+void sim_traces(const SimConfig& c, const int idx0, const int n,
+                const int nthreads, std::vector< std::vector<LookStat> >& tr){
+ tr.assign(n, std::vector<LookStat>());
+ std::vector<Workspace> ws(task_workers(nthreads));
+ run_tasks(n, nthreads, [&](const int k){
+   TrialAnalysis ta(idx0 + k + 1, c, ws[thread_num()]);
+   ta.trace();
+   tr[k] = ta.st;
+ });
+}
+
+
+// the rules of every scenario on every trace, scenario by scenario. the
+// traces were made with nmaxsero, a scenario with a smaller one has its
+// immu analyses redone (trace_nmaxsero) on a copy first.
+std::vector<TrialResult> replay_traces(const std::vector<SimConfig>& scen,
+                   const std::vector< std::vector<LookStat> >& tr,
+                   const int nmaxsero){
+ int n = (int)tr.size();
+ int nscen = (int)scen.size();
+ LogMute mute;
+ std::vector<TrialResult> res(nscen * n);
+ Workspace ws;
+ std::vector<LookStat> st;
+ for(int k = 0; k < nscen; k++){
+   bool redo = scen[k].nmaxsero != nmaxsero;
+   for(int i = 0; i < n; i++){
+     if(redo){
+       st = tr[i];
+       trace_nmaxsero(st, scen[k], ws);
+     }
+     res[k * n + i] = trial_rules(tr[i][0].idxsim, scen[k], redo ? st : tr[i],
+                                  nullptr);
+   }
+ }
+ return res;
+}
+
+
+// the immu interim and final analyses of one trial's trace, made with a
+// larger nmaxsero, redone for cfg.nmaxsero from the counts it holds. the
+// rng streams are those of the trial so the result is that of simulating
+// it under cfg.
+void trace_nmaxsero(std::vector<LookStat>& st, const SimConfig& cfg,
+                    Workspace& ws){
+ ws.fit(cfg);
+ Rng rng(cfg.seed, st[0].idxsim);
+ for(int i = 0; i < cfg.nlooks() && cfg.looks[i] <= cfg.nmaxsero; i++){
+   LookStat& s = st[i];
+   if(s.immu){
+     SeroCount lnsero;
+     lnsero.n_sero_ctl = s.n_sero_ctl;
+     lnsero.n_sero_trt = s.n_sero_trt;
+     ImmuRes r = sim_immu_counts(s.look, s.nobs, lnsero, cfg, rng, ws);
+     s.i_ppn = r.ppos_n;
+     s.i_ppmax = r.ppos_max;
+     s.i_draws = r.n_draw;
+   }
+   if(s.i_fin){
+     immu_final_stat(cfg, rng, ws, s);
+   }
+ }
+}
+
+
+// the batch of trials idx all run under c
+std::vector<TrialTask> trial_tasks(const SimConfig& c,
+                                   const std::vector<int>& idx){
+ std::vector<TrialTask> tasks;
+ for(int i : idx){
+   tasks.push_back({&c, i});
+ }
+ return tasks;
+}
+
+
+// runs the tasks, res[k] for tasks[k]
+void sim_trials(const std::vector<TrialTask>& tasks,
+                std::vector<TrialResult>& res, const int nthreads){
+ std::vector<Workspace> ws;
+ sim_trials(tasks, res, nthreads, ws);
+}
+
+
+// as above with the workers' workspaces kept in ws between calls
+void sim_trials(const std::vector<TrialTask>& tasks,
+                std::vector<TrialResult>& res, const int nthreads,
+                std::vector<Workspace>& ws){
+
+ res.assign(tasks.size(), TrialResult());
+ if((int)ws.size() < task_workers(nthreads)){
+   ws.resize(task_workers(nthreads));
+ }
+ run_tasks((int)tasks.size(), nthreads, [&](const int i){
+   res[i] = sim_dotrial(tasks[i].idxsim, *tasks[i].cfg, ws[thread_num()]);
+ });
+}
+
+
+// runs trials 1..nsims under c that are not yet in the results file at
+// path (see resfile.h), a chunk of flush_every at a time so that an
+// interrupted run loses at most the chunk in progress. a file written
+// under another seed or cfg is refused. the workers keep their
+// workspaces from one chunk to the next. returns the number run,
+// throws std::runtime_error if the file cannot be used.
+int sim_batch_file(const SimConfig& c, const int nsims, const int nthreads,
+                   const std::string& path, const int flush_every){
+
+ ResKey key;
+ key.seed = c.seed;
+ key.cfg = c.result_hash();
+ ResWriter w(path, key, result_schema());
+
+ std::vector<int> todo;
+ for(int i = 1; i <= nsims; i++){
+   if(!w.is_done(i)) todo.push_back(i);
+ }
+
+ int nrun = 0;
+ std::vector<int32_t> ints;
+ std::vector<double> dbls;
+ std::vector<TrialResult> res;
+ std::vector<Workspace> ws;
+ for(int k = 0; k < (int)todo.size(); k += flush_every){
+   int kend = std::min((int)todo.size(), k + flush_every);
+   std::vector<int> idx(todo.begin() + k, todo.begin() + kend);
+   sim_trials(trial_tasks(c, idx), res, nthreads, ws);
+   for(const TrialResult& r : res){
+     ints.clear();
+     dbls.clear();
+     for(int j = 0; j < n_result_cols; j++){
+       if(result_cols[j].i) ints.push_back(r.*result_cols[j].i);
+       else dbls.push_back(r.*result_cols[j].x);
+     }
+     w.add(ints.data(), dbls.data());
+   }
+   w.flush();
+   nrun += (int)idx.size();
+   if(user_interrupt) user_interrupt();
+ }
+
+ return nrun;
+}
+
+
+std::vector<ResColumn> result_schema(){
+ std::vector<ResColumn> cols;
+ for(int j = 0; j < n_result_cols; j++){
+   ResColumn c;
+   c.name = result_cols[j].name;
+   c.type = result_cols[j].i ? RES_INT : RES_DBL;
+   cols.push_back(c);
+ }
+ return cols;
+}
+
+
+ResTable result_table(const std::vector<TrialResult>& res){
+ ResTable t;
+ t.cols = result_schema();
+ t.nrow = (int)res.size();
+ for(int j = 0; j < n_result_cols; j++){
+   if(result_cols[j].i){
+     std::vector<int32_t> v(t.nrow);
+     for(int k = 0; k < t.nrow; k++) v[k] = res[k].*result_cols[j].i;
+     t.icol.push_back(v);
+   } else {
+     std::vector<double> v(t.nrow);
+     for(int k = 0; k < t.nrow; k++) v[k] = res[k].*result_cols[j].x;
+     t.dcol.push_back(v);
+   }
+ }
+ return t;
+}
+
+
+// simulates one complete trial, ws.d is (re)populated with the trial data
+TrialResult sim_dotrial(const int idxsim,
+                        const SimConfig& cfg,
+                        Workspace& ws){
+
+  PerfTimer timer(PF_TRIAL);
+  log_ev(LOG_DEBUG, EV_TRIAL_START, idxsim, 0);
+
+  TrialAnalysis ta(idxsim, cfg, ws);
+  TrialResult ret = trial_rules(idxsim, cfg, ta.st, &ta);
+
+  return ret;
+}
+
+
+// the stopping rules of cfg applied to the analyses of one trial. with ta
+// given each analysis is run when the rules first need it, which is how
+// sim_dotrial proceeds. without it the analyses are read from st, which
+// must then be a trace (TrialAnalysis::trace) of the same trial.
+TrialResult trial_rules(const int idxsim,
+                        const SimConfig& cfg,
+                        const std::vector<LookStat>& st,
+                        TrialAnalysis* ta){
+
+  const std::vector<int>& looks = cfg.looks;
+  const std::vector<double>& post_tte_sup_thresh = cfg.post_tte_sup_thresh;
+
+  //Trial t(cfg, vstop, ifut, cfut, csup, inc);
+  Trial t(cfg);
+  int look = 0;
+  int immulook = 0;
+  int clinlook = 0;
+  int i = 0;
+  for(i = 0; i < cfg.nlooks(); i++){
+    // look is here because all the original methods were called from R with r indexing
+    look = i + 1;
+    perf_count(PC_LOOK);
+
+    // we may not have started analysing the clin ep yet, but
+    // we still need to set ss here otherwise it would just be recorded as 0 and
+    // we would therefore underestimate the avg
+    t.clin_set_ss(looks[i]);
+
+    if(t.do_immu(looks[i])){
+      immulook = look;
+      const LookStat& s = ta ? ta->immu(look) : st[i];
+
+      if(s.i_ppmax < cfg.pp_sero_fut_thresh){
+
+        log_ev(LOG_INFO, EV_IMMU_FUT, idxsim, look,
+               {(double)s.n_sero_ctl, (double)s.n_sero_trt, (double)s.nobs,
+                s.i_ppmax, cfg.pp_sero_fut_thresh});
+        t.immu_fut();
+        t.immu_set_ss(s.nobs);
+        break;
+      }
+
+      if (s.i_ppn > cfg.pp_sero_sup_thresh && !t.is_immu_fut()){
+        log_ev(LOG_INFO, EV_IMMU_SUP, idxsim, look,
+               {(double)s.n_sero_ctl, (double)s.n_sero_trt, (double)s.nobs,
+                s.i_ppn, cfg.pp_sero_sup_thresh});
+        t.immu_stopv();
+      }
+      t.immu_set_ss(s.nobs);
+    }
+
+
+    if(t.do_clin(looks[i])){
+      clinlook = look;
+      const LookStat& s = ta ? ta->clin(look) : st[i];
+
+      if(s.c_ppmax < cfg.pp_tte_fut_thresh){
+        log_ev(LOG_INFO, EV_CLIN_FUT, idxsim, look,
+               {s.c_ppmax, cfg.pp_tte_fut_thresh});
+        t.clin_fut();
+        break;
+      }
+
+      if (s.c_ppn > post_tte_sup_thresh[i]  && !t.is_clin_fut()){
+        log_ev(LOG_INFO, EV_CLIN_SUP, idxsim, look,
+               {s.c_ppn, post_tte_sup_thresh[i]});
+        t.clin_sup();
+        break;
+      }
+    }
+
+
+    // if at last look set inconclusive
+    if(i == cfg.nlooks()-1){
+      t.inconclusive();
+    }
+
+
+  }
+
+
+
+  // final analysis for sero
+  const LookStat& fi = ta ? ta->immu_final(immulook) : st[immulook - 1];
+  t.immu_final_win(fi.i_post > cfg.post_final_thresh);
+
+  // final analysis for tte
+  if(look > cfg.nlooks()) look = cfg.nlooks();
+  const LookStat& fc = ta ? ta->clin_final(look) : st[look - 1];
+  t.clin_final_win(fc.c_post > cfg.post_final_thresh);
+
+
+  TrialResult ret;
+  ret.idxsim = idxsim;
+  ret.p0 = cfg.baselineprobsero;
+  ret.p1 = cfg.trtprobsero;
+  ret.m0 = log(2)/cfg.b0tte;
+  ret.m1 = log(2)/(cfg.b0tte + cfg.b1tte);
+  ret.look = i < cfg.nlooks() ? looks[i] : looks.back();
+  ret.ss_immu = t.get_immu_ss();
+  ret.ss_clin = t.get_clin_ss();
+  ret.stop_v_samp = t.is_v_samp_stopped();
+  ret.stop_i_fut = t.is_immu_fut();
+  ret.stop_c_fut = t.is_clin_fut();
+  ret.stop_c_sup = t.is_clin_sup();
+  ret.inconclu = t.is_inconclusive();
+  ret.i_final = t.immu_final();
+  ret.c_final = t.clin_final();
+  ret.i_ppn = immulook > 0 ? st[immulook - 1].i_ppn : na_real();
+  ret.i_ppmax = immulook > 0 ? st[immulook - 1].i_ppmax : na_real();
+  ret.c_ppn = clinlook > 0 ? st[clinlook - 1].c_ppn : na_real();
+  ret.c_ppmax = clinlook > 0 ? st[clinlook - 1].c_ppmax : na_real();
+  ret.i_mean = fi.i_mean;
+  ret.i_lwr = fi.i_lwr;
+  ret.i_upr = fi.i_upr;
+  ret.c_mean = fc.c_mean;
+  ret.c_lwr = fc.c_lwr;
+  ret.c_upr = fc.c_upr;
+
+  log_ev(LOG_INFO, EV_TRIAL_END, idxsim, look,
+         {(double)ret.ss_immu, (double)ret.ss_clin, (double)ret.inconclu,
+          (double)ret.i_final, (double)ret.c_final});
+
+  return ret;
+}
+
+
+// reserve, counting the buffers that have to grow
+template <typename T>
+inline void ws_reserve(std::vector<T>& v, const size_t n){
+ if(v.capacity() < n){
+   perf_count(PC_ALLOC);
+   v.reserve(n);
+ }
+}
+
+// sizes every buffer for the largest look of cfg. a no-op once sized for
+// a cfg with the same dimensions (n, post_draw, draw_threads).
+void Workspace::fit(const SimConfig& cfg){
+
+ int n = cfg.nstop;
+ int npd = cfg.post_draw;
+ // the most future results in one arm of an immu ppos
+ int nfut = cfg.nmaxsero / 2 + 1;
+
+ // counted as one, its arrays grow together
+ if(d.trt.capacity() < (size_t)n) perf_count(PC_ALLOC);
+ d.reserve(n);
+ ws_reserve(st, cfg.nlooks());
+ for(int a = 0; a < 2; a++){
+   ws_reserve(clin_tally.open[a], n);
+   ws_reserve(ci.accrt[a], n);
+   ws_reserve(ci.age[a], n);
+   ws_reserve(ci.obst[a], n);
+   ws_reserve(ci.pos[a], n);
+   ws_reserve(pr[a], nfut + 1);
+ }
+ ws_reserve(clin_tally.still, n);
+ ws_reserve(ci.arm, n);
+ ws_reserve(ci.slot, n);
+ ws_reserve(ci.uimpute, n);
+ ws_reserve(tail, nfut + 2);
+
+ if(clin.m.n_rows != (arma::uword)npd){
+   perf_count(PC_ALLOC, 6);
+   clin.m.set_size(npd, 3);
+   clin.ppos_int_ratio_gt1.set_size(npd);
+   clin.ppos_max_ratio_gt1.set_size(npd);
+   post.set_size(npd, 3);
+   for(int k = 0; k < 2; k++){
+     pp[k].postprobdelta_gt0.set_size(npd);
+   }
+ }
+
+ if((int)draw.size() < cfg.draw_threads){
+   draw.resize(cfg.draw_threads);
+ }
+ for(DrawScratch& sc : draw){
+   for(int a = 0; a < 2; a++){
+     ws_reserve(sc.evtt[a], n);
+   }
+   if(!cfg.clin_pp_analytic && sc.m_pp_int.n_rows != (arma::uword)npd){
+     perf_count(PC_ALLOC, 2);
+     sc.m_pp_int.set_size(npd, 3);
+     sc.m_pp_max.set_size(npd, 3);
+   }
+   ws_reserve(sc.memo, (size_t)nfut * nfut);
+ }
+}
+
+
+TrialAnalysis::TrialAnalysis(const int idxsim, const SimConfig& cfg,
+                             Workspace& ws) :
+  cfg(cfg), ws(ws), d(ws.d), rng(cfg.seed, idxsim), clin_tally(ws.clin_tally),
+  idxsim(idxsim), st(ws.st) {
+  ws.fit(cfg);
+  // outcomes are drawn as the looks reach them
+  sim_dat_enrol(cfg, rng, d);
+  clin_tally.reset();
+  st.assign(cfg.nlooks(), LookStat());
+  for(int i = 0; i < cfg.nlooks(); i++){
+    st[i].idxsim = idxsim;
+    st[i].look = i + 1;
+  }
+}
+
+
+const LookStat& TrialAnalysis::immu(const int look){
+
+  LookStat& s = st[look - 1];
+  if(s.immu) return s;
+
+  s.nobs = sim_n_obs(d, look, cfg.interimmnths, cfg.sero_info_delay);
+  sim_dat_outcomes(cfg, rng, s.nobs, d);
+  ImmuRes r = sim_immu(d, cfg, look, rng, sero_tally, ws);
+  s.immu = 1;
+  s.n_sero_ctl = r.n_sero_ctl;
+  s.n_sero_trt = r.n_sero_trt;
+  s.i_ppn = r.ppos_n;
+  s.i_ppmax = r.ppos_max;
+  s.i_draws = r.n_draw;
+  log_ev(LOG_DEBUG, EV_IMMU_LOOK, idxsim, look,
+         {(double)cfg.looks[look - 1], (double)s.nobs, s.i_ppn, s.i_ppmax,
+          (double)s.i_draws});
+  return s;
+}
+
+
+const LookStat& TrialAnalysis::clin(const int look){
+
+  LookStat& s = st[look - 1];
+  if(s.clin) return s;
+
+  sim_dat_outcomes(cfg, rng, cfg.looks[look - 1], d);
+  const ClinRes& r = sim_clin(d, cfg, look, idxsim, rng, clin_tally, ws);
+  s.clin = 1;
+  s.n_evnt_0 = r.lss_post.n_evnt_0;
+  s.n_evnt_1 = r.lss_post.n_evnt_1;
+  s.tot_obst_0 = r.lss_post.tot_obst_0;
+  s.tot_obst_1 = r.lss_post.tot_obst_1;
+  s.c_ppn = r.ppn_win;
+  s.c_ppmax = r.ppmax_win;
+  s.c_draws = r.n_draw;
+  log_ev(LOG_DEBUG, EV_CLIN_LOOK, idxsim, look,
+         {(double)cfg.looks[look - 1], (double)s.n_evnt_0, (double)s.n_evnt_1,
+          s.c_ppn, s.c_ppmax});
+  return s;
+}
+
+
+// final immu analysis with look as the last immu look
+const LookStat& TrialAnalysis::immu_final(const int look){
+
+  LookStat& s = st[look - 1];
+  if(s.i_fin) return s;
+  PerfTimer timer(PF_FINAL);
+
+  //how many successes in each arm?
+  //if(looks[immulook] > (int)cfg["nmaxsero"]) immulook = immulook - 1;
+  int nobs = sim_n_obs(d, look, cfg.interimmnths, 0);
+  sim_dat_outcomes(cfg, rng, nobs, d);
+  SeroCount lnsero = sero_tally.count(d, nobs);
+
+  s.f_nobs = nobs;
+  s.f_sero_ctl = lnsero.n_sero_ctl;
+  s.f_sero_trt = lnsero.n_sero_trt;
+  immu_final_stat(cfg, rng, ws, s);
+  log_ev(LOG_INFO, EV_IMMU_FINAL, idxsim, look,
+         {(double)s.f_sero_ctl, (double)s.f_sero_trt, (double)nobs, s.i_mean,
+          s.i_post});
+
+  s.i_fin = 1;
+  return s;
+}
+
+
+// the final immu posterior from the counts f_sero_ctl and f_sero_trt of
+// s, taken as nmaxsero results, into the i_ final fields of s
+void immu_final_stat(const SimConfig& cfg, const Rng& rng, Workspace& ws,
+                     LookStat& s){
+
+  SeroCount lnsero;
+  lnsero.n_sero_ctl = s.f_sero_ctl;
+  lnsero.n_sero_trt = s.f_sero_trt;
+
+  // posterior at this interim
+  arma::mat& m = ws.post;
+  sim_immu_interim_post(m, cfg.nmaxsero, cfg.post_draw, lnsero,
+                        rng.stream(STREAM_FINAL_IMMU, 0), PP_MC_PLAIN);
+  int n_gt0 = col_count_gt(m, COL_DELTA, 0);
+  double post_prob_gt0 =  (double)n_gt0 / (double)cfg.post_draw;
+  double i_mym = arma::mean(m.col(COL_DELTA));
+  double i_mysd = arma::stddev(m.col(COL_DELTA));
+  double i_lwr = i_mym - 1.96 * i_mysd;
+  double i_upr = i_mym + 1.96 * i_mysd;
+  i_mym = round(i_mym * 1000) / 1000;
+  i_lwr = round(i_lwr * 1000) / 1000;
+  i_upr = round(i_upr * 1000) / 1000;
+
+  s.i_post = post_prob_gt0;
+  s.i_mean = i_mym;
+  s.i_lwr = i_lwr;
+  s.i_upr = i_upr;
+}
+
+
+// final clin analysis were the trial to stop at look. resets the
+// censoring state in d so any interim analyses must come first.
+const LookStat& TrialAnalysis::clin_final(const int look){
+
+ LookStat& s = st[look - 1];
+ if(s.c_fin) return s;
+ PerfTimer timer(PF_FINAL);
+
+ sim_dat_outcomes(cfg, rng, cfg.looks[look - 1], d);
+ d.clear_cen_obst();
+
+ // updates the censoring state in d
+ ClinSuffStat lss = sim_clin_set_state(d, look, 36, cfg);
+
+ double n_evnt_0b = lss.n_evnt_0;
+ double n_evnt_1b = lss.n_evnt_1;
+ double tot_obst_0 = lss.tot_obst_0;
+ double tot_obst_1 = lss.tot_obst_1;
+
+ double a = cfg.prior_gamma_a;
+ double b = cfg.prior_gamma_b;
+
+ arma::mat& m = ws.post;
+ Rng rfin = rng.stream(STREAM_FINAL_CLIN, 0);
+
+ for(int j = 0; j < cfg.post_draw; j++){
+   // compute the posterior based on the __observed__ data to the time of the interim
+   // take single draw
+   m(j, COL_LAMB0) = rfin.rgamma(a + n_evnt_0b, 1/(b + tot_obst_0));
+   m(j, COL_LAMB1) = rfin.rgamma(a + n_evnt_1b, 1/(b + tot_obst_1));
+   m(j, COL_RATIO) = m(j, COL_LAMB0) / m(j, COL_LAMB1);
+ }
+
+ int n_gt1 = col_count_gt(m, COL_RATIO, 1);
+ double post_prob_gt1 =  (double)n_gt1 / (double)cfg.post_draw;
+
+ double c_mym = arma::mean(m.col(COL_RATIO));
+ double c_mysd = arma::stddev(m.col(COL_RATIO));
+ double c_lwr = c_mym - 1.96 * c_mysd;
+ double c_upr = c_mym + 1.96 * c_mysd;
+ c_mym = round(c_mym * 1000) / 1000;
+ c_lwr = round(c_lwr * 1000) / 1000;
+ c_upr = round(c_upr * 1000) / 1000;
+
+ log_ev(LOG_INFO, EV_CLIN_FINAL, idxsim, look,
+        {(double)cfg.looks[look - 1], n_evnt_0b, n_evnt_1b, c_mym, post_prob_gt1});
+
+ s.c_fin = 1;
+ s.c_post = post_prob_gt1;
+ s.c_mean = c_mym;
+ s.c_lwr = c_lwr;
+ s.c_upr = c_upr;
+ return s;
+}
+
+
+// every analysis the rules could ask for at every look, whatever cfg's
+// thresholds would decide
+void TrialAnalysis::trace(){
+ for(int look = 1; look <= cfg.nlooks(); look++){
+   if(cfg.looks[look - 1] <= cfg.nmaxsero) immu(look);
+   clin(look);
+ }
+ for(int look = 1; look <= cfg.nlooks(); look++){
+   if(cfg.looks[look - 1] <= cfg.nmaxsero) immu_final(look);
+   clin_final(look);
+ }
+}
+
+
+// data generation
+
+
+
+TrialData sim_dat(const SimConfig& cfg, const Rng& rng) {
+ TrialData d;
+ sim_dat(cfg, rng, d);
+ return d;
+}
+
+
+// each subject draws from their own substream so their data does not
+// depend on how many others were generated before them, or when. d is
+// cleared and refilled with the whole cohort, keeping its memory.
+void sim_dat(const SimConfig& cfg, const Rng& rng, TrialData& d) {
+ sim_dat_enrol(cfg, rng, d);
+ sim_dat_outcomes(cfg, rng, d.size(), d);
+}
+
+
+// enrols all nstop with their arm, accrual time and age, the covariates
+// that the clinical predictive draws need for those not yet enrolled at
+// a look. no outcomes, see sim_dat_outcomes.
+void sim_dat_enrol(const SimConfig& cfg, const Rng& rng, TrialData& d) {
+
+ PerfTimer timer(PF_DAT);
+ int n = cfg.nstop;
+ Rng rdat = rng.stream(STREAM_DAT, 0);
+ double tpp = cfg.months_per_person;
+
+ d.clear();
+ d.reserve(n);
+ d.probt3_trt = cfg.deltaserot3;
+ // fu 1 and 2 times from time of accrual
+ // fu 1 is between 14 and 21 days from accrual
+ // fu 2 is between 28 and 55 days from accrual
+ d.fu1 = 0.575; //R::runif((double)cfg["fu1_lwr"], (double)cfg["fu1_upr"]);
+ d.fu2 = 1.36345; // R::runif((double)cfg["fu2_lwr"], (double)cfg["fu2_upr"]);
+
+ for(int i = 0; i < n; i++){
+
+   Rng r = rdat.substream(i);
+
+   int trt = ((i-1)%2 == 0) ? ARM_CTL : ARM_TRT;
+   int j = d.add(trt);
+   ArmData& s = d.arm[trt];
+
+   // simultaneous accrual of each next ctl/trt pair
+   s.accrt[j] = (i%2 == 0) ? ((i+1)*tpp)+tpp : (i+1)*tpp;
+
+   // d(i, COL_AGE) = r_truncnorm(cfg["age_months_mean"], cfg["age_months_sd"],
+   //   cfg["age_months_lwr"], cfg["age_months_upr"]);
+
+   s.age[j] = r.runif(cfg.age_months_lwr, cfg.age_months_upr);
+ }
+ d.index_accrual();
+}
+
+
+// draws the outcomes of the enrolled d.n_out up to n, continuing each
+// subject's substream after their age. a trial calls it as each look
+// needs more subjects so one that stops early never draws the rest.
+void sim_dat_outcomes(const SimConfig& cfg, const Rng& rng, const int n,
+                      TrialData& d) {
+
+ if(n <= d.n_out) return;
+ PerfTimer timer(PF_DAT);
+ perf_count(PC_SUBJ, n - d.n_out);
+ Rng rdat = rng.stream(STREAM_DAT, 0);
+
+ for(int i = d.n_out; i < n; i++){
+
+   Rng r = rdat.substream(i);
+   // the age, drawn at enrolment
+   r.unif();
+
+   int trt = d.trt[i];
+   int j = d.pos[i];
+   ArmData& s = d.arm[trt];
+
+   s.serot2[j] = r.rbinom(1, cfg.baselineprobsero);
+   s.serot3[j] = s.serot2[j];
+
+   if(s.serot2[j] == 0 && trt == ARM_TRT){
+     s.serot3[j] = r.rbinom(1, d.probt3_trt);
+   }
+
+
+   // tte - the paramaterisation of rexp uses SCALE NOTE RATE!!!!!!!!!!!
+   // event time is the time from randomisation (not birth) at which first
+   // medical presentation occurs
+   if(trt == ARM_CTL){
+     s.evtt[j] = r.rexp(1/cfg.b0tte)  ;
+   } else {
+     double beta = cfg.b0tte + cfg.b1tte;
+     s.evtt[j] = r.rexp(1/beta)  ;
+   }
+
+ }
+ d.n_out = n;
+}
+
+
+// clinical endpoint
+
+
+
+// posterior probability that lambda0 / lambda1 > 1 given the suff stats.
+// closed form via the incomplete beta (see specfun.h) unless cfg asks for
+// the original estimate from post_draw pairs of gamma draws, in which case
+// m_pp is the scratch for the draws, or with pp_conditional from
+// post_draw lambda1 draws alone.
+double clin_post_ratio_gt1(const ClinSuffStat& lss, const SimConfig& cfg,
+                           arma::mat& m_pp, Rng& r){
+
+ double a = cfg.prior_gamma_a;
+ double b = cfg.prior_gamma_b;
+
+ if(cfg.clin_pp_analytic){
+   return prob_gamma_ratio_gt1(a + lss.n_evnt_0, b + lss.tot_obst_0,
+                               a + lss.n_evnt_1, b + lss.tot_obst_1);
+ }
+
+ if(cfg.pp_conditional){
+   // P(lambda0 > lambda1 | lambda1) from the gamma cdf in place of the
+   // lambda0 draw, averaged over the lambda1 draws
+   double p = 0;
+   for(int j = 0; j < cfg.post_draw; j++){
+     double l1 = r.rgamma(a + lss.n_evnt_1, 1/(b + lss.tot_obst_1));
+     p += 1 - pgamma_reg(l1 * (b + lss.tot_obst_0), a + lss.n_evnt_0);
+   }
+   return p / (double)cfg.post_draw;
+ }
+
+ for(int j = 0; j < cfg.post_draw; j++){
+   m_pp(j, COL_LAMB0) = r.rgamma(a + lss.n_evnt_0, 1/(b + lss.tot_obst_0));
+   m_pp(j, COL_LAMB1) = r.rgamma(a + lss.n_evnt_1, 1/(b + lss.tot_obst_1));
+   m_pp(j, COL_RATIO) = m_pp(j, COL_LAMB0) / m_pp(j, COL_LAMB1);
+ }
+ // empirical posterior probability that ratio_lamb > 1
+ return (double)col_count_gt(m_pp, COL_RATIO, 1) / (double)cfg.post_draw;
+}
+
+
+// splits the trial into the fixed part and the scratch part redrawn by
+// the predictive draws (see ClinImpute), filling ci. tally must have been
+// updated to this look. the closed subjects and those censored at max age
+// (reason 4) have the same event and exposure with any follow up, so
+// fixed is the same at the interim and at the final look.
+void clin_impute_set(const TrialData& d, const ClinTally& tally,
+                     const int look, const double fu,
+                     const SimConfig& cfg, ClinImpute& ci){
+
+ int mylook = look - 1;
+ int nlooks = cfg.nlooks();
+
+ ci.clear();
+ double tot_fixed[2] = {0, 0};
+ std::vector<int>* imp = ci.pos;
+
+ for(int a = 0; a < 2; a++){
+   const ArmData& s = d.arm[a];
+   int n = d.n_in_arm(a, cfg.looks[mylook]);
+   int nmax = d.n_in_arm(a, cfg.looks[nlooks - 1]);
+   // all enrolled in order rather than tally.open so the fixed exposure
+   // does not depend on the look the tally started at
+   for(int j = 0; j < n; j++){
+     if(s.impute[j] == 1){
+       imp[a].push_back(j);
+       ci.accrt[a].push_back(s.accrt[j]);
+       ci.age[a].push_back(s.age[j]);
+       ci.obst[a].push_back(s.obst[j]);
+     } else {
+       tot_fixed[a] += s.obst[j];
+     }
+   }
+   ci.n_imp[a] = (int)ci.accrt[a].size();
+   for(int j = n; j < nmax; j++){
+     ci.accrt[a].push_back(s.accrt[j]);
+     ci.age[a].push_back(s.age[j]);
+     ci.obst[a].push_back(0);
+   }
+ }
+
+ // enrolment order (id), imputed first then future
+ const std::vector<int>& id0 = d.arm[ARM_CTL].id;
+ const std::vector<int>& id1 = d.arm[ARM_TRT].id;
+ int k[2] = {0, 0};
+ while(k[0] < ci.n_imp[0] || k[1] < ci.n_imp[1]){
+   int a = ARM_TRT;
+   if(k[1] == ci.n_imp[1] ||
+      (k[0] < ci.n_imp[0] && id0[imp[0][k[0]]] < id1[imp[1][k[1]]])){
+     a = ARM_CTL;
+   }
+   ci.uimpute.push_back(d.arm[a].id[imp[a][k[a]]] - 1);
+   ci.arm.push_back((uint8_t)a);
+   ci.slot.push_back(k[a]++);
+ }
+ ci.n_uimpute = (int)ci.arm.size();
+ for(int i = cfg.looks[mylook]; i < cfg.looks[nlooks - 1]; i++){
+   int a = d.trt[i];
+   ci.arm.push_back((uint8_t)a);
+   ci.slot.push_back(k[a]++);
+ }
+
+ ci.fixed.n_evnt_0 = tally.n_evnt_closed[ARM_CTL];
+ ci.fixed.tot_obst_0 = tot_fixed[ARM_CTL];
+ ci.fixed.n_evnt_1 = tally.n_evnt_closed[ARM_TRT];
+ ci.fixed.tot_obst_1 = tot_fixed[ARM_TRT];
+ ci.fixed.fu = fu;
+}
+
+// suff stats for one predictive draw given the scratch event times evtt
+// (one vector per arm, laid out as ci). at the interim when with_future
+// is false, otherwise at the final look including the future subjects.
+ClinSuffStat clin_impute_suffstat(const ClinImpute& ci,
+                                  const std::vector<double>* evtt,
+                                  const bool with_future, const int look,
+                                  const double fu, const SimConfig& cfg){
+
+ double mon = cfg.interimmnths[look - 1];
+ ClinSuffStat ret = ci.fixed;
+ ArmSuffStat s[2];
+ for(int a = 0; a < 2; a++){
+   int n = with_future ? (int)ci.accrt[a].size() : ci.n_imp[a];
+   s[a] = arm_suffstat(ci.accrt[a].data(), ci.age[a].data(), evtt[a].data(),
+                       n, mon, fu, cfg.max_age_fu_months);
+ }
+ ret.n_evnt_0 += s[ARM_CTL].n_evnt;
+ ret.tot_obst_0 += s[ARM_CTL].tot_obst;
+ ret.n_evnt_1 += s[ARM_TRT].n_evnt;
+ ret.tot_obst_1 += s[ARM_TRT].tot_obst;
+ return ret;
+}
+
+
+// each posterior predictive draw i uses its own substream of the
+// clinical stream for this look. the draws only write their own
+// scratch event times, the trial data is left as set at this look.
+// tally carries the state from the previous look of the same trial, a
+// fresh one gives the full recomputation.
+const ClinRes& sim_clin(TrialData& d, const SimConfig& cfg,
+                        const int look, const int idxsim, const Rng& rng,
+                        ClinTally& tally, Workspace& ws) {
+
+ PerfTimer timer(PF_CLIN);
+ int post_draw = cfg.post_draw;
+ int mylook = look - 1;
+ double fu = cfg.max_age_fu_months;
+
+ double a = cfg.prior_gamma_a;
+ double b = cfg.prior_gamma_b;
+
+ ClinRes& ret = ws.clin;
+ arma::mat& m = ret.m;
+ arma::vec& ppos_int_ratio_gt1 = ret.ppos_int_ratio_gt1;
+ arma::vec& ppos_max_ratio_gt1 = ret.ppos_max_ratio_gt1;
+
+ // compute suff stats (calls visits and censoring) for the current interim
+ ClinSuffStat lss_post = tally.update(d, look, cfg);
+ int n_evnt_0 = lss_post.n_evnt_0;
+ int n_evnt_1 = lss_post.n_evnt_1;
+ double tot_obst_0 = lss_post.tot_obst_0;
+ double tot_obst_1 = lss_post.tot_obst_1;
+
+ // subjs that require imputation, in order of enrolment
+ ClinImpute& ci = ws.ci;
+ clin_impute_set(d, tally, look, fu, cfg, ci);
+
+ // containers for next imputed data sufficient stats, from the last draw
+ ClinSuffStat lss_int;
+ ClinSuffStat lss_max;
+
+ int int_win = 0;
+ int max_win = 0;
+
+ // for i in postdraws do posterior predictive trials
+ // 1. for the interim (if we are at less than 50 per qtr)
+ // 2. for the max sample size
+ // draws may run on cfg.draw_threads threads. each owns its scratch and
+ // draw i always uses substream i so the results do not depend on the
+ // number of threads.
+ // with pp_mc the lambdas are coordinates 0 and 1 of the point set
+ PpUnif pu(cfg.pp_mc, rng.stream(STREAM_CLIN, look));
+ int nthreads = cfg.draw_threads;
+ // with pp_adaptive the draws come in batches until the futility and
+ // superiority decisions at this look are settled
+ int batch = cfg.pp_adaptive ? cfg.pp_batch : post_draw;
+ double z = cfg.pp_adaptive ? seq_z(cfg.pp_adaptive_alpha, post_draw, batch) : 0;
+ int ndraw = 0;
+ bool settled = false;
+ PerfTimer timer_ppos(PF_CLIN_PPOS);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+#endif
+ {
+
+   // scratch event times for the imputed and future subjs, reused by
+   // every draw, and for the monte carlo posterior probabilities
+   DrawScratch& sc = ws.draw[thread_num()];
+   std::vector<double>* evtt = sc.evtt;
+   for(int k = 0; k < 2; k++){
+     evtt[k].resize(ci.accrt[k].size());
+   }
+   arma::mat& m_pp_int = sc.m_pp_int;
+   arma::mat& m_pp_max = sc.m_pp_max;
+
+   for(int i0 = 0; i0 < post_draw && !settled; i0 += batch){
+     int i1 = std::min(post_draw, i0 + batch);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static) reduction(+:int_win,max_win) lastprivate(lss_int,lss_max)
+#endif
+     for(int i = i0; i < i1; i++){
+
+       Rng r = pu.rng(i);
+
+       // compute the posterior based on the __observed__ data to the time of the interim
+       // take single draw
+       if(pu.inverse()){
+         m(i, COL_LAMB0) = qgamma_std(pu.u(i, 0, r), a + n_evnt_0) / (b + tot_obst_0);
+         m(i, COL_LAMB1) = qgamma_std(pu.u(i, 1, r), a + n_evnt_1) / (b + tot_obst_1);
+       } else {
+         m(i, COL_LAMB0) = r.rgamma(a + n_evnt_0, 1/(b + tot_obst_0));
+         m(i, COL_LAMB1) = r.rgamma(a + n_evnt_1, 1/(b + tot_obst_1));
+       }
+       m(i, COL_RATIO) = m(i, COL_LAMB0) / m(i, COL_LAMB1);
+       double scale[2] = {1/m(i, COL_LAMB0), 1/m(i, COL_LAMB1)};
+
+       // use memoryless prop of exponential and impute enrolled kids that have not
+       // yet had event.
+       for(int j = 0; j < ci.n_uimpute; j++){
+         int trt = ci.arm[j];
+         int k = ci.slot[j];
+         evtt[trt][k] = ci.obst[trt][k] + r.rexp(scale[trt]);
+       }
+
+       // update view of the sufficent stats using enrolled
+       // kids that have all now been given an event time
+       lss_int = clin_impute_suffstat(ci, evtt, false, look, fu, cfg);
+       // posterior probability that ratio_lamb > 1
+       ppos_int_ratio_gt1(i) = clin_post_ratio_gt1(lss_int, cfg, m_pp_int, r);
+       //INFO(*log_os, idxsim, "ugt1.n_elem = " << ugt1.n_elem << " ppos_int_ratio_gt1(" << i << ") = " << ppos_int_ratio_gt1(i));
+       if(ppos_int_ratio_gt1(i) > 0.96){
+         int_win++;
+       }
+
+       // impute the remaining kids
+       for(int j = ci.n_uimpute; j < (int)ci.arm.size(); j++){
+         int trt = ci.arm[j];
+         evtt[trt][ci.slot[j]] = r.rexp(scale[trt])  ;
+       }
+
+       // the state up to the max sample size at time of the final analysis
+       lss_max = clin_impute_suffstat(ci, evtt, true, cfg.nlooks(), fu, cfg);
+       // what does the posterior at max sample size say?
+       ppos_max_ratio_gt1(i) = clin_post_ratio_gt1(lss_max, cfg, m_pp_max, r);
+       //INFO(*log_os, idxsim, "ugt1.n_elem = " << ugt1.n_elem << " ppos_max_ratio_gt1(" << i << ") = " << ppos_max_ratio_gt1(i));
+       if(ppos_max_ratio_gt1(i) > 0.96){
+         max_win++;
+       }
+
+     }
+
+#ifdef _OPENMP
+#pragma omp single
+#endif
+     {
+       ndraw = i1;
+       if(cfg.pp_adaptive){
+         // futile whatever ppn_win turns out to be, or both sides known
+         WinBound bmax(max_win, ndraw, z);
+         settled = bmax.upr < cfg.pp_tte_fut_thresh ||
+           (bmax.clear_of(cfg.pp_tte_fut_thresh) &&
+            WinBound(int_win, ndraw, z).clear_of(cfg.post_tte_sup_thresh[mylook]));
+       }
+     }
+   }
+
+ }
+
+ ret.ppn = arma::mean(ppos_int_ratio_gt1.head(ndraw));
+ ret.ppmax = arma::mean(ppos_max_ratio_gt1.head(ndraw));
+
+ ret.ppn_win = (double)int_win/(double)ndraw;
+ ret.ppmax_win = (double)max_win/(double)ndraw;
+ ret.n_draw = ndraw;
+ perf_count(PC_DRAW, ndraw);
+
+ ret.lss_post = lss_post;
+ ret.lss_int = lss_int;
+ ret.lss_max = lss_max;
+
+ return ret;
+}
+
+
+ClinSuffStat sim_clin_set_state(TrialData& d, const int look,
+                                const double fu,
+                                const SimConfig& cfg){
+
+ // this updates the state of d in place
+ // and provides sufficient stats.
+ PerfTimer timer(PF_CLIN_STATE);
+
+ int mylook = look - 1;
+
+ int n_evnt[2] = {0, 0};
+ double tot_obst[2] = {0, 0};
+
+ const std::vector<int>& looks = cfg.looks;
+ const std::vector<double>& months = cfg.interimmnths;
+ double max_age_fu = cfg.max_age_fu_months;
+
+ // set censoring and event times up to current enrolled
+ // these kids were all enrolled prior to the current look
+ for(int a = 0; a < 2; a++){
+
+   ArmData& s = d.arm[a];
+   int n = d.n_in_arm(a, looks[mylook]);
+
+   for(int j = 0; j < n; j++){
+
+     double reftime = months[mylook];
+     if(fu != 0 && fu - s.age[j] + s.accrt[j] > months[mylook]){
+       reftime = fu - s.age[j] + s.accrt[j];
+     }
+     DBG(*log_os, "reftime " << reftime );
+
+     n_evnt[a] += clin_subj_state(s, j, reftime, max_age_fu) == 1;
+   }
+   // summed in the same order as sim_clin_suffstat
+   tot_obst[a] = lane_sum(s.obst.data(), n);
+ }
+
+ ClinSuffStat ret;
+ ret.n_evnt_0 = n_evnt[ARM_CTL];
+ ret.tot_obst_0 = tot_obst[ARM_CTL];
+ ret.n_evnt_1 = n_evnt[ARM_TRT];
+ ret.tot_obst_1 = tot_obst[ARM_TRT];
+ ret.fu = fu;
+
+ return ret;
+}
+
+
+// censoring state of subject j of an arm given the time to which they
+// are followed up, written in place. returns the reason.
+int clin_subj_state(ArmData& s, const int j, const double reftime,
+                    const double max_age_fu){
+
+ s.reftime[j] = reftime;
+
+ if(s.accrt[j] + s.evtt[j] <= reftime &&
+    s.age[j] + s.evtt[j] <= max_age_fu){
+   // observed event
+   // dont impute
+   s.cen[j] = 0;
+   s.obst[j] = s.evtt[j];
+   s.reason[j] = 1;
+   s.impute[j] = 0;
+
+ } else if (s.accrt[j] + s.evtt[j] <= reftime &&
+   s.age[j] + s.evtt[j] > max_age_fu){
+   // censor at max age
+   // dont impute
+   s.cen[j] = 1;
+   s.obst[j] = max_age_fu - s.age[j];
+   s.reason[j] = 2;
+   s.impute[j] = 0;
+
+ } else if (s.accrt[j] + s.evtt[j] > reftime &&
+   reftime - s.accrt[j] <= max_age_fu - s.age[j]){
+   // censor at mnth - accrual (t2)
+   // impute
+   s.cen[j] = 1;
+   s.obst[j] = reftime - s.accrt[j] ;
+   s.reason[j] = 3;
+   s.impute[j] = 1;
+
+ } else { // mnth - accrual >= max age - age at accrual
+   // censor at max age
+   // dont impute
+   s.cen[j] = 1;
+   s.obst[j] = max_age_fu - s.age[j] ;
+   s.reason[j] = 4;
+   s.impute[j] = 0;
+
+ }
+
+ return s.reason[j];
+}
+
+
+// updates the state of those enrolled by this look that may still
+// change, see ClinTally. the suff stats are those of sim_clin_set_state
+// with no follow up: exposure is summed over every enrolled subject with
+// lane_sum so that it does not depend on the look the tally started at.
+// starts over (as a full recomputation) when called for a look that is
+// not after the last one.
+ClinSuffStat ClinTally::update(TrialData& d, const int look, const SimConfig& cfg){
+
+ PerfTimer timer(PF_CLIN_STATE);
+ if(look <= this->look){
+   reset();
+ }
+ if(this->look == 0){
+   d.clear_cen_obst();
+ }
+ this->look = look;
+
+ int mylook = look - 1;
+ double mon = cfg.interimmnths[mylook];
+ double max_age_fu = cfg.max_age_fu_months;
+ double tot_obst[2] = {0, 0};
+
+ for(int a = 0; a < 2; a++){
+   ArmData& s = d.arm[a];
+   int n = d.n_in_arm(a, cfg.looks[mylook]);
+   still.clear();
+
+   // those still open then the newly enrolled, ascending either way
+   for(int k = 0; k < (int)open[a].size() + n - n_done[a]; k++){
+     int j = k < (int)open[a].size() ? open[a][k] : n_done[a] + k - (int)open[a].size();
+     int reason = clin_subj_state(s, j, mon, max_age_fu);
+     if(reason <= 2){
+       n_evnt_closed[a] += reason == 1;
+     } else {
+       still.push_back(j);
+     }
+   }
+   open[a].swap(still);
+   n_done[a] = n;
+   // the closed keep the obst they closed with
+   tot_obst[a] = lane_sum(s.obst.data(), n);
+ }
+
+ ClinSuffStat ret;
+ ret.n_evnt_0 = n_evnt_closed[ARM_CTL];
+ ret.tot_obst_0 = tot_obst[ARM_CTL];
+ ret.n_evnt_1 = n_evnt_closed[ARM_TRT];
+ ret.tot_obst_1 = tot_obst[ARM_TRT];
+ ret.fu = 0;
+
+ return ret;
+}
+
+
+// the same suff stats as sim_clin_set_state without touching the
+// per subject state, for the predictive draws that only need the sums.
+ClinSuffStat sim_clin_suffstat(const TrialData& d, const int look,
+                               const double fu,
+                               const SimConfig& cfg){
+
+ int mylook = look - 1;
+ double mon = cfg.interimmnths[mylook];
+
+ ArmSuffStat s[2];
+ for(int a = 0; a < 2; a++){
+   const ArmData& x = d.arm[a];
+   int n = d.n_in_arm(a, cfg.looks[mylook]);
+   s[a] = arm_suffstat(x.accrt.data(), x.age.data(), x.evtt.data(), n,
+                       mon, fu, cfg.max_age_fu_months);
+ }
+
+ ClinSuffStat ret;
+ ret.n_evnt_0 = s[ARM_CTL].n_evnt;
+ ret.tot_obst_0 = s[ARM_CTL].tot_obst;
+ ret.n_evnt_1 = s[ARM_TRT].n_evnt;
+ ret.tot_obst_1 = s[ARM_TRT].tot_obst;
+ ret.fu = fu;
+
+ return ret;
+}
+
+
+// immunological endpoint
+
+
+
+ImmuRes sim_immu(const TrialData& d, const SimConfig& cfg,
+                 const int look, const Rng& rng, SeroTally& tally,
+                 Workspace& ws){
+
+ PerfTimer timer(PF_IMMU);
+ if(cfg.looks[look - 1] > cfg.nmaxsero){
+   return ImmuRes();
+ }
+
+ // how many records did we observe in total (assumes balance)
+ int nobs = sim_n_obs(d, look, cfg.interimmnths, (float)cfg.sero_info_delay);
+
+ // how many successes in each arm?
+ SeroCount lnsero = tally.count(d, nobs);
+
+ return sim_immu_counts(look, nobs, lnsero, cfg, rng, ws);
+}
+
+
+// the immu interim analysis of sim_immu given the nobs results in and
+// their seroconversions, so that a trace can be analysed again under
+// another nmaxsero
+ImmuRes sim_immu_counts(const int look, const int nobs,
+                        const SeroCount& lnsero, const SimConfig& cfg,
+                        const Rng& rng, Workspace& ws){
+
+ int mylook = look - 1;
+ int nimpute1 = 0;
+ int nimpute2 = 0;
+ PposRes& pp1 = ws.pp[0];
+ PposRes& pp2 = ws.pp[1];
+ pp1.n_draw = 0;
+ pp2.n_draw = 0;
+ ImmuRes ret;
+
+ // posterior at this interim
+ arma::mat& m = ws.post;
+ sim_immu_interim_post(m, nobs, cfg.post_draw, lnsero,
+                       rng.stream(STREAM_IMMU_POST, look), cfg.pp_mc);
+
+ // therefore how many do we need to impute assuming that we
+ // were enrolling at the 50 per interim rate?
+ nimpute1 = cfg.looks_target[mylook] - nobs;
+
+ // if nimpute > 0 then do the ppos calc
+ double post1gt0 = 0;
+ if(nimpute1 > 0){
+   // predicted prob of success at interim
+   sim_immu_ppos_test(m, look, nobs, nimpute1, cfg.post_draw, lnsero, cfg,
+                      rng.stream(STREAM_IMMU_PPOS_N, look),
+                      cfg.pp_sero_sup_thresh, pp1, ws);
+ } else {
+   // else compute the posterior prob that delta > 0
+   post1gt0 = (double)col_count_gt(m, COL_DELTA, 0) / (double)cfg.post_draw;
+ }
+
+ // predicted prob of success at nmaxsero
+ // if nimpute2 == 0 then we are at nmaxsero with no information delay so just report
+ // the posterior prob that delta is gt 0 (post1gt0) which has already been computed above.
+ nimpute2 = cfg.nmaxsero - nobs;
+ if(nimpute2 > 0){
+   sim_immu_ppos_test(m, look, nobs, nimpute2, cfg.post_draw, lnsero, cfg,
+                      rng.stream(STREAM_IMMU_PPOS_MAX, look),
+                      cfg.pp_sero_fut_thresh, pp2, ws);
+ }
+
+
+ // assess posterior
+ double mean_delta =  arma::mean(m.col(COL_DELTA));
+ double sd_delta =  arma::stddev(m.col(COL_DELTA));
+ double lwr = mean_delta - 1.96 * sd_delta;
+ double upr = mean_delta + 1.96 * sd_delta;
+ mean_delta = round(mean_delta * 1000) / 1000;
+ lwr = round(lwr * 1000) / 1000;
+ upr = round(upr * 1000) / 1000;
+
+
+ ret.done = true;
+ ret.ppos_n = nimpute1 > 0 ? pp1.ppos : post1gt0;
+ ret.ppos_max = nimpute2 > 0 ? pp2.ppos : post1gt0;
+ ret.nimpute1 = nimpute1;
+ ret.nimpute2 = nimpute2;
+ ret.delta = mean_delta;
+ ret.lwr = lwr;
+ ret.upr = upr;
+ ret.n_sero_ctl = lnsero.n_sero_ctl;
+ ret.n_sero_trt = lnsero.n_sero_trt;
+ ret.n_draw = pp1.n_draw + pp2.n_draw;
+
+ return ret;
+}
+
+
+// binary search on the accrual index built by sim_dat / trial_from_mat
+int sim_n_obs(const TrialData& d,
+              const int look,
+              const std::vector<double>& months,
+              const double info_delay){
+
+ // set look to zero (first element of array)
+ int mylook = look - 1;
+ return d.n_obs_by(months[mylook], info_delay);
+}
+
+
+SeroCount sim_lnsero(const TrialData& d,
+                     const int nobs){
+
+ SeroTally t;
+ SeroCount l = t.count(d, nobs);
+
+ //DBG(*log_os, "nobs " << nobs);
+ //DBG(*log_os, "n_sero_ctl " << l.n_sero_ctl);
+ //DBG(*log_os, "n_sero_trt " << l.n_sero_trt);
+
+ return l;
+}
+
+
+// counts from the last call and adds those enrolled since, starting
+// over if nobs went down.
+SeroCount SeroTally::count(const TrialData& d, const int nobs){
+
+ if(nobs < this->nobs){
+   *this = SeroTally();
+ }
+
+ // the first nobs enrolled are a prefix of each arm
+ for(int a = 0; a < 2; a++){
+   const std::vector<uint8_t>& serot3 = d.arm[a].serot3;
+   int n = d.n_in_arm(a, nobs);
+   for(int j = d.n_in_arm(a, this->nobs); j < n; j++){
+     n_sero[a] += serot3[j];
+   }
+ }
+ this->nobs = nobs;
+
+ SeroCount l;
+ l.n_sero_ctl = n_sero[ARM_CTL];
+ l.n_sero_trt = n_sero[ARM_TRT];
+ return l;
+}
+
+
+// the thetas are the leading coordinates (0, 1) of the pp_mc point set,
+// sim_immu_ppos_test carries on with the counts.
+void sim_immu_interim_post(arma::mat& m,
+                          const int nobs,
+                          const int post_draw,
+                          const SeroCount& lnsero,
+                          const Rng& rng,
+                          const int pp_mc){
+
+ PerfTimer timer(PF_IMMU_POST);
+ double a0 = 1 + lnsero.n_sero_ctl;
+ double b0 = 1 + (nobs/2) - lnsero.n_sero_ctl;
+ double a1 = 1 + lnsero.n_sero_trt;
+ double b1 = 1 + (nobs/2) - lnsero.n_sero_trt;
+ PpUnif pu(pp_mc, rng);
+ for(int i = 0; i < post_draw; i++){
+   Rng r = pu.rng(i);
+   if(pu.inverse()){
+     m(i, COL_THETA0) = qbeta_reg(pu.u(i, 0, r), a0, b0);
+     m(i, COL_THETA1) = qbeta_reg(pu.u(i, 1, r), a1, b1);
+   } else {
+     m(i, COL_THETA0) = r.rbeta(a0, b0);
+     m(i, COL_THETA1) = r.rbeta(a1, b1);
+   }
+   m(i, COL_DELTA) = m(i, COL_THETA1) - m(i, COL_THETA0);
+ }
+
+ return;
+
+}
+
+
+// fills res, whose postprobdelta_gt0 must have post_draw rows
+void sim_immu_ppos_test(const arma::mat& m,
+                        const int look,
+                        const int nobs,
+                        const int nimpute,
+                        const int post_draw,
+                        const SeroCount& lnsero,
+                        const SimConfig& cfg,
+                        const Rng& rng,
+                        const double thresh,
+                        PposRes& res,
+                        Workspace& ws){
+
+ PerfTimer timer(PF_IMMU_PPOS);
+ if(cfg.immu_pp_enumerate){
+   sim_immu_ppos_enum(look, nobs, nimpute, lnsero, cfg, res, ws);
+   return;
+ }
+
+ int mylook = look - 1;
+ int win = 0;
+ arma::vec& postprobdelta_gt0 = res.postprobdelta_gt0;
+
+ const std::vector<double>& post_sero_win_thresh = cfg.post_sero_win_thresh;
+
+ int ntarget = nobs + nimpute;
+
+ // create 1000 phony interims conditional on our current understanding
+ // of theta0 and theta1. draws may run on cfg.draw_threads threads, each
+ // with its own memo table; draw i always uses substream i. with
+ // pp_adaptive they come in batches until ppos is clear of thresh.
+ int nthreads = cfg.draw_threads;
+ int batch = cfg.pp_adaptive ? cfg.pp_batch : post_draw;
+ double z = cfg.pp_adaptive ? seq_z(cfg.pp_adaptive_alpha, post_draw, batch) : 0;
+ int ndraw = 0;
+ bool settled = false;
+ // the counts are coordinates 2 and 3 after the thetas
+ PpUnif pu(cfg.pp_mc, rng);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+#endif
+ {
+
+   SeroProbTable pgt0(ntarget/2, lnsero.n_sero_ctl, lnsero.n_sero_trt, nimpute/2,
+                      ws.draw[thread_num()].memo);
+
+   for(int i0 = 0; i0 < post_draw && !settled; i0 += batch){
+     int i1 = std::min(post_draw, i0 + batch);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static) reduction(+:win)
+#endif
+     for(int i = i0; i < i1; i++){
+
+       Rng r = pu.rng(i);
+
+       // This is a view of the total draws at a sample size of nobs + nimpute
+       int n_sero_ctl = lnsero.n_sero_ctl;
+       int n_sero_trt = lnsero.n_sero_trt;
+       if(pu.inverse()){
+         n_sero_ctl += qbinom_inv(pu.u(i, 2, r), nimpute/2, m(i, COL_THETA0));
+         n_sero_trt += qbinom_inv(pu.u(i, 3, r), nimpute/2, m(i, COL_THETA1));
+       } else {
+         n_sero_ctl += r.rbinom((nimpute/2), m(i, COL_THETA0));
+         n_sero_trt += r.rbinom((nimpute/2), m(i, COL_THETA1));
+       }
+
+       // exact posterior probability that delta > 0 (was a normal
+       // approximation to the two beta posteriors)
+       postprobdelta_gt0(i) = pgt0(n_sero_ctl, n_sero_trt);
+
+       if(postprobdelta_gt0(i) > post_sero_win_thresh[mylook]){
+         win++;
+       }
+     }
+
+#ifdef _OPENMP
+#pragma omp single
+#endif
+     {
+       ndraw = i1;
+       settled = cfg.pp_adaptive && WinBound(win, ndraw, z).clear_of(thresh);
+     }
+   }
+
+ }
+
+ res.ppos = (double)win / (double)ndraw;
+ res.n_draw = ndraw;
+ perf_count(PC_DRAW, ndraw);
+
+ DBG(*log_os, "immu pp impute " << nimpute << " num win " << win << " ppos " << res.ppos <<
+   " post thresh for win " << post_sero_win_thresh[mylook] );
+
+}
+
+
+
+
+// ppos without sampling. the future counts in each arm are beta-binomial
+// under the current posterior so sum their joint pmf over the (ctl, trt)
+// grid where the trial wins. P(theta1 > theta0) rises with the trt count
+// and falls with the ctl count so the win region is everything on or above
+// a boundary that never decreases as the ctl count goes up, found by a
+// single walk through the memoised table. n_draw is 0 as there are no
+// draws.
+void sim_immu_ppos_enum(const int look,
+                        const int nobs,
+                        const int nimpute,
+                        const SeroCount& lnsero,
+                        const SimConfig& cfg,
+                        PposRes& res,
+                        Workspace& ws){
+
+ int mylook = look - 1;
+ int nfut = nimpute/2;
+ int ntarget = nobs + nimpute;
+ double thresh = cfg.post_sero_win_thresh[mylook];
+
+ SeroProbTable pgt0(ntarget/2, lnsero.n_sero_ctl, lnsero.n_sero_trt, nfut,
+                    ws.draw[0].memo);
+
+ // predictive pmf of the future seroconversions in each arm
+ std::vector<double>& pr0 = ws.pr[0];
+ std::vector<double>& pr1 = ws.pr[1];
+ dbetabinom_all(nfut, 1 + lnsero.n_sero_ctl, 1 + nobs/2 - lnsero.n_sero_ctl, pr0);
+ dbetabinom_all(nfut, 1 + lnsero.n_sero_trt, 1 + nobs/2 - lnsero.n_sero_trt, pr1);
+
+ // upper tail of the trt pmf, tail1[k] = P(y1 >= k)
+ std::vector<double>& tail1 = ws.tail;
+ tail1.assign(nfut + 2, 0.0);
+ for(int k = nfut; k >= 0; k--){
+   tail1[k] = tail1[k + 1] + pr1[k];
+ }
+
+ double ppos = 0;
+ int bnd = 0;
+ for(int y0 = 0; y0 <= nfut; y0++){
+   while(bnd <= nfut &&
+         pgt0(lnsero.n_sero_ctl + y0, lnsero.n_sero_trt + bnd) <= thresh){
+     bnd++;
+   }
+   if(bnd > nfut) break;
+   ppos += pr0[y0] * tail1[bnd];
+ }
+
+ res.ppos = std::min(1.0, ppos);
+ res.n_draw = 0;
+
+ DBG(*log_os, "immu pp enum impute " << nimpute << " ppos " << res.ppos <<
+   " post thresh for win " << thresh );
+}
+
+
+// logrank for the first n enrolled using the censoring state in d, ctl is
+// group 0. strata is by enrolment index, empty for no stratification.
+LogrankStat sim_logrank(const TrialData& d, const int n,
+                        const std::vector<int>& strata){
+
+ // stratum labels in order of first appearance
+ std::vector<int> lev;
+ if(strata.empty()){
+   lev.push_back(0);
+ } else {
+   for(int i = 0; i < n; i++){
+     if(std::find(lev.begin(), lev.end(), strata[i]) == lev.end()){
+       lev.push_back(strata[i]);
+     }
+   }
+ }
+
+ LogrankStat st;
+ std::vector<double> z[2];
+ std::vector<double> t[2];
+ for(int k = 0; k < (int)lev.size(); k++){
+   for(int a = 0; a < 2; a++){
+     const ArmData& s = d.arm[a];
+     z[a].clear();
+     t[a].clear();
+     for(int j = 0; j < d.n_in_arm(a, n); j++){
+       if(!strata.empty() && strata[s.id[j] - 1] != lev[k]) continue;
+       z[a].push_back(s.obst[j]);
+       if(s.cen[j] == 0) t[a].push_back(s.obst[j]);
+     }
+   }
+   logrank_add(st, z[ARM_CTL], t[ARM_CTL], z[ARM_TRT], t[ARM_TRT]);
+ }
+
+ return st;
+}
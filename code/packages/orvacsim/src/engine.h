@@ -0,0 +1,485 @@
+#ifndef ORVACSIM_ENGINE_H
+#define ORVACSIM_ENGINE_H
+
+// the simulation engine: data generation, the immu and clin analyses, the
+// trial rules and the batch runners, with no R in sight. simulation.cpp
+// wraps it for R (the rcpp_ exports) and cli/ builds it into a native
+// program. armadillo comes through RcppArmadillo in the package, which
+// must be included before any other armadillo header, and directly in
+// the native build (ORVACSIM_NATIVE).
+
+#ifdef ORVACSIM_NATIVE
+#include <armadillo>
+#else
+#include <RcppArmadillo.h>
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <exception>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "rng.h"
+#include "config.h"
+#include "specfun.h"
+#include "trialdata.h"
+#include "suffstat.h"
+#include "logrank.h"
+#include "resfile.h"
+#include "tracefile.h"
+#include "seqmc.h"
+#include "qmc.h"
+#include "evlog.h"
+#include "perfctr.h"
+
+// column indices
+#define COL_ID            0
+#define COL_TRT           1
+#define COL_ACCRT         2
+#define COL_AGE           3
+#define COL_SEROT2        4
+#define COL_SEROT3        5
+#define COL_PROBT3        6
+#define COL_EVTT          7
+#define COL_FU1           8
+#define COL_FU2           9
+#define COL_CEN           10
+#define COL_OBST          11
+#define COL_REASON        12
+#define COL_IMPUTE        13
+#define COL_REFTIME       14
+#define NCOL              15
+
+#define COL_THETA0        0
+#define COL_THETA1        1
+#define COL_DELTA         2
+
+#define COL_LAMB0         0
+#define COL_LAMB1         1
+#define COL_RATIO         2
+
+
+
+
+
+#define _DEBUG 0
+
+#if _DEBUG
+#define DBG( os, msg )                                \
+(os) << "DBG: " << __FILE__ << "(" << __LINE__ << ") "\
+ << msg << std::endl
+#else
+#define DBG( os, msg )
+#endif
+
+// DBG writes to log_os, std::cout unless the R shim points it at
+// Rcpp::Rcout. the engine's events go to the event log (evlog.h).
+extern std::ostream* log_os;
+
+
+// polled on the calling thread between trials, the R shim points it at
+// Rcpp::checkUserInterrupt. may throw to abandon the run.
+extern void (*user_interrupt)();
+
+// R's NA_real_, a nan with payload 1954, so that results reach R as NA
+inline double na_real(){
+ const uint64_t bits = 0x7FF00000000007A2ULL;
+ double x;
+ std::memcpy(&x, &bits, sizeof x);
+ return x;
+}
+
+
+
+
+// engine results - plain structs, the rcpp_ exports convert them to
+// lists.
+
+// sufficient stats for the clinical endpoint
+struct ClinSuffStat {
+ int n_evnt_0 = 0;
+ double tot_obst_0 = 0;
+ int n_evnt_1 = 0;
+ double tot_obst_1 = 0;
+ double fu = 0;
+};
+
+// the draws have post_draw rows of which the first n_draw are used
+struct ClinRes {
+ double ppn = 0;
+ double ppmax = 0;
+ double ppn_win = 0;
+ double ppmax_win = 0;
+ int n_draw = 0;
+ ClinSuffStat lss_post;
+ ClinSuffStat lss_int;
+ ClinSuffStat lss_max;
+ arma::mat m;
+ arma::vec ppos_int_ratio_gt1;
+ arma::vec ppos_max_ratio_gt1;
+};
+
+struct SeroCount {
+ int n_sero_ctl = 0;
+ int n_sero_trt = 0;
+};
+
+// clinical state carried between the looks of one trial. an observed
+// event (reason 1) or a censoring at max age after the event time has
+// passed (reason 2) is final, so each look only revisits those still
+// censored at the last look (reason 3 or 4) and the newly enrolled.
+struct ClinTally {
+ int look = 0;                    // last look processed, 0 for none
+ int n_done[2] = {0, 0};          // prefix of each arm visited so far
+ std::vector<int> open[2];        // positions with reason 3 or 4, ascending
+ int n_evnt_closed[2] = {0, 0};
+ // swapped with open[a] by update
+ std::vector<int> still;
+
+ ClinSuffStat update(TrialData& d, const int look, const SimConfig& cfg);
+
+ // back to no looks, keeping the capacity
+ void reset(){
+   look = 0;
+   for(int a = 0; a < 2; a++){
+     n_done[a] = 0;
+     open[a].clear();
+     n_evnt_closed[a] = 0;
+   }
+ }
+};
+
+// seroconversions among the first nobs enrolled, carried between looks
+struct SeroTally {
+ int nobs = 0;
+ int n_sero[2] = {0, 0};
+
+ SeroCount count(const TrialData& d, const int nobs);
+};
+
+// the subjects whose event times are redrawn by the clinical predictive
+// draws, by arm in compact arrays: first those censored at the interim
+// (impute == 1) then those not yet enrolled. slot/arm give the enrolment
+// order so the draws consume the rng as they always have. the rest of
+// the trial is fixed across draws and enters only through fixed.
+struct ClinImpute {
+ std::vector<double> accrt[2];
+ std::vector<double> age[2];
+ // follow up already accrued, zero for the not yet enrolled
+ std::vector<double> obst[2];
+ int n_imp[2] = {0, 0};
+ std::vector<uint8_t> arm;
+ std::vector<int> slot;
+ int n_uimpute = 0;
+ // enrolment index of the imputed
+ std::vector<int> uimpute;
+ // position of the imputed within each arm
+ std::vector<int> pos[2];
+ ClinSuffStat fixed;
+
+ // empty, keeping the capacity
+ void clear(){
+   for(int a = 0; a < 2; a++){
+     accrt[a].clear();
+     age[a].clear();
+     obst[a].clear();
+     pos[a].clear();
+     n_imp[a] = 0;
+   }
+   arm.clear();
+   slot.clear();
+   n_uimpute = 0;
+   uimpute.clear();
+   fixed = ClinSuffStat();
+ }
+};
+
+// postprobdelta_gt0 has post_draw rows of which the first n_draw are used
+struct PposRes {
+ double ppos = 0;
+ int n_draw = 0;
+ arma::vec postprobdelta_gt0;
+};
+
+// done is false when the look is beyond nmaxsero (no analysis)
+struct ImmuRes {
+ bool done = false;
+ double ppos_n = 0;
+ double ppos_max = 0;
+ int nimpute1 = 0;
+ int nimpute2 = 0;
+ double delta = 0;
+ double lwr = 0;
+ double upr = 0;
+ int n_sero_ctl = 0;
+ int n_sero_trt = 0;
+ // predictive draws used by ppos_n and ppos_max
+ int n_draw = 0;
+};
+
+// exact P(theta1 > theta0) when each arm has n_per_arm results, x0 (ctl)
+// and x1 (trt) seroconversions and a uniform prior. the predictive counts
+// only span base + 0..nfuture in each arm so the probabilities are
+// memoised on that grid and computed on first use. the memo is the
+// caller's so that it can be reused.
+class SeroProbTable {
+private:
+ int n;
+ int base0;
+ int base1;
+ int w;
+ std::vector<double>& p;
+
+public:
+ SeroProbTable(const int n_per_arm, const int x0_base, const int x1_base,
+               const int nfuture, std::vector<double>& memo) :
+   n(n_per_arm), base0(x0_base), base1(x1_base), w(nfuture + 1),
+   p(memo) {
+   p.assign((size_t)w * w, -1.0);
+ }
+
+ double operator()(const int x0, const int x1){
+   double& v = p[(size_t)(x0 - base0) * w + (x1 - base1)];
+   if(v < 0){
+     v = prob_beta_gt(1 + x1, 1 + n - x1, 1 + x0, 1 + n - x0);
+   }
+   return v;
+ }
+};
+
+// scratch of the predictive draws on one of the draw_threads
+struct DrawScratch {
+ // event times of the imputed and future subjs
+ std::vector<double> evtt[2];
+ // posterior draws of clin_post_ratio_gt1 when clin_pp_analytic is 0
+ arma::mat m_pp_int;
+ arma::mat m_pp_max;
+ // SeroProbTable memo
+ std::vector<double> memo;
+};
+
+// everything the analyses of one trial worker write. fit() sizes it from
+// the config, after which every look of every trial the worker runs
+// reuses the same memory so a warm worker does not allocate. the
+// analyses leave their results here, valid until the next call.
+struct Workspace {
+ TrialData d;
+ std::vector<LookStat> st;
+ ClinTally clin_tally;
+ ClinImpute ci;
+ ClinRes clin;
+ PposRes pp[2];
+ // posterior draws of sim_immu and the final analyses
+ arma::mat post;
+ // beta-binomial pmfs and tail of sim_immu_ppos_enum
+ std::vector<double> pr[2];
+ std::vector<double> tail;
+ std::vector<DrawScratch> draw;
+
+ void fit(const SimConfig& cfg);
+};
+
+// summary of a single simulated trial - one row of the batch results
+struct TrialResult {
+ int idxsim = 0;
+ double p0 = 0;
+ double p1 = 0;
+ double m0 = 0;
+ double m1 = 0;
+ double look = 0;
+ int ss_immu = 0;
+ int ss_clin = 0;
+ int stop_v_samp = 0;
+ int stop_i_fut = 0;
+ int stop_c_fut = 0;
+ int stop_c_sup = 0;
+ int inconclu = 0;
+ int i_final = 0;
+ int c_final = 0;
+ double i_ppn = na_real();
+ double i_ppmax = na_real();
+ double c_ppn = na_real();
+ double c_ppmax = na_real();
+ double i_mean = 0;
+ double i_lwr = 0;
+ double i_upr = 0;
+ double c_mean = 0;
+ double c_lwr = 0;
+ double c_upr = 0;
+};
+
+// the columns of the batch results in order, shared by the data.frame
+// and the results file. exactly one of i and x is set.
+struct ResultCol {
+ const char* name;
+ int TrialResult::* i;
+ double TrialResult::* x;
+};
+
+static const ResultCol result_cols[] = {
+ {"idxsim", &TrialResult::idxsim, nullptr},
+ {"p0", nullptr, &TrialResult::p0},
+ {"p1", nullptr, &TrialResult::p1},
+ {"m0", nullptr, &TrialResult::m0},
+ {"m1", nullptr, &TrialResult::m1},
+ {"look", nullptr, &TrialResult::look},
+ {"ss_immu", &TrialResult::ss_immu, nullptr},
+ {"ss_clin", &TrialResult::ss_clin, nullptr},
+ {"stop_v_samp", &TrialResult::stop_v_samp, nullptr},
+ {"stop_i_fut", &TrialResult::stop_i_fut, nullptr},
+ {"stop_c_fut", &TrialResult::stop_c_fut, nullptr},
+ {"stop_c_sup", &TrialResult::stop_c_sup, nullptr},
+ {"inconclu", &TrialResult::inconclu, nullptr},
+ {"i_final", &TrialResult::i_final, nullptr},
+ {"c_final", &TrialResult::c_final, nullptr},
+ {"i_ppn", nullptr, &TrialResult::i_ppn},
+ {"i_ppmax", nullptr, &TrialResult::i_ppmax},
+ {"c_ppn", nullptr, &TrialResult::c_ppn},
+ {"c_ppmax", nullptr, &TrialResult::c_ppmax},
+ {"i_mean", nullptr, &TrialResult::i_mean},
+ {"i_lwr", nullptr, &TrialResult::i_lwr},
+ {"i_upr", nullptr, &TrialResult::i_upr},
+ {"c_mean", nullptr, &TrialResult::c_mean},
+ {"c_lwr", nullptr, &TrialResult::c_lwr},
+ {"c_upr", nullptr, &TrialResult::c_upr}
+};
+static const int n_result_cols = sizeof(result_cols) / sizeof(result_cols[0]);
+
+// one trial of a batch or grid
+struct TrialTask {
+ const SimConfig* cfg;
+ int idxsim;
+};
+
+// the data and analyses of one simulated trial, held in the worker's
+// workspace (ws.d, ws.st). each analysis runs at most once per look and
+// leaves its result in st.
+class TrialAnalysis {
+private:
+ const SimConfig& cfg;
+ Workspace& ws;
+ TrialData& d;
+ Rng rng;
+ // state carried from one look to the next
+ SeroTally sero_tally;
+ ClinTally& clin_tally;
+
+public:
+ const int idxsim;
+ std::vector<LookStat>& st;
+
+ TrialAnalysis(const int idxsim, const SimConfig& cfg, Workspace& ws);
+ const LookStat& immu(const int look);
+ const LookStat& clin(const int look);
+ const LookStat& immu_final(const int look);
+ const LookStat& clin_final(const int look);
+ void trace();
+};
+
+
+
+
+// function prototypes
+
+TrialData sim_dat(const SimConfig& cfg, const Rng& rng);
+void sim_dat(const SimConfig& cfg, const Rng& rng, TrialData& d);
+void sim_dat_enrol(const SimConfig& cfg, const Rng& rng, TrialData& d);
+void sim_dat_outcomes(const SimConfig& cfg, const Rng& rng, const int n,
+                      TrialData& d);
+
+const ClinRes& sim_clin(TrialData& d, const SimConfig& cfg,
+                        const int look, const int idxsim, const Rng& rng,
+                        ClinTally& tally, Workspace& ws);
+void clin_impute_set(const TrialData& d, const ClinTally& tally,
+                     const int look, const double fu,
+                     const SimConfig& cfg, ClinImpute& ci);
+ClinSuffStat clin_impute_suffstat(const ClinImpute& ci,
+                                  const std::vector<double>* evtt,
+                                  const bool with_future, const int look,
+                                  const double fu, const SimConfig& cfg);
+double clin_post_ratio_gt1(const ClinSuffStat& lss, const SimConfig& cfg,
+                           arma::mat& m_pp, Rng& r);
+ClinSuffStat sim_clin_set_state(TrialData& d, const int look,
+                                const double fu,
+                                const SimConfig& cfg);
+int clin_subj_state(ArmData& s, const int j, const double reftime,
+                    const double max_age_fu);
+ClinSuffStat sim_clin_suffstat(const TrialData& d, const int look,
+                               const double fu,
+                               const SimConfig& cfg);
+
+ImmuRes sim_immu(const TrialData& d, const SimConfig& cfg,
+                 const int look, const Rng& rng, SeroTally& tally,
+                 Workspace& ws);
+ImmuRes sim_immu_counts(const int look, const int nobs,
+                        const SeroCount& lnsero, const SimConfig& cfg,
+                        const Rng& rng, Workspace& ws);
+void immu_final_stat(const SimConfig& cfg, const Rng& rng, Workspace& ws,
+                     LookStat& s);
+int sim_n_obs(const TrialData& d,
+              const int look,
+              const std::vector<double>& months,
+              const double info_delay);
+SeroCount sim_lnsero(const TrialData& d,
+                     const int nobs);
+void sim_immu_interim_post(arma::mat& m,
+                          const int nobs,
+                          const int post_draw,
+                          const SeroCount& lnsero,
+                          const Rng& rng,
+                          const int pp_mc);
+void sim_immu_ppos_test(const arma::mat& m,
+                        const int look,
+                        const int nobs,
+                        const int nimpute,
+                        const int post_draw,
+                        const SeroCount& lnsero,
+                        const SimConfig& cfg,
+                        const Rng& rng,
+                        const double thresh,
+                        PposRes& res,
+                        Workspace& ws);
+void sim_immu_ppos_enum(const int look,
+                        const int nobs,
+                        const int nimpute,
+                        const SeroCount& lnsero,
+                        const SimConfig& cfg,
+                        PposRes& res,
+                        Workspace& ws);
+
+LogrankStat sim_logrank(const TrialData& d, const int n,
+                        const std::vector<int>& strata);
+
+void sim_traces(const SimConfig& c, const int idx0, const int n,
+                const int nthreads, std::vector< std::vector<LookStat> >& tr);
+std::vector<TrialResult> replay_traces(const std::vector<SimConfig>& scen,
+                   const std::vector< std::vector<LookStat> >& tr,
+                   const int nmaxsero);
+void trace_nmaxsero(std::vector<LookStat>& st, const SimConfig& cfg,
+                    Workspace& ws);
+void sim_trials(const std::vector<TrialTask>& tasks,
+                std::vector<TrialResult>& res, const int nthreads);
+void sim_trials(const std::vector<TrialTask>& tasks,
+                std::vector<TrialResult>& res, const int nthreads,
+                std::vector<Workspace>& ws);
+int sim_batch_file(const SimConfig& c, const int nsims, const int nthreads,
+                   const std::string& path, const int flush_every);
+std::vector<TrialTask> trial_tasks(const SimConfig& c,
+                                   const std::vector<int>& idx);
+std::vector<ResColumn> result_schema();
+ResTable result_table(const std::vector<TrialResult>& res);
+TrialResult sim_dotrial(const int idxsim, const SimConfig& cfg,
+                        Workspace& ws);
+TrialResult trial_rules(const int idxsim, const SimConfig& cfg,
+                        const std::vector<LookStat>& st, TrialAnalysis* ta);
+
+#endif
@@ -0,0 +1,298 @@
+// the event log, see evlog.h
+
+#include "evlog.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+std::atomic<int> log_level(LOG_OFF);
+
+
+// the statistics of each event, in the order log_ev is given them
+struct LogEvent {
+ const char* name;
+ const char* x[LOG_NX];
+};
+
+static const LogEvent log_events[EV_COUNT] = {
+ {"dropped", {"n"}},
+ {"trial_start", {}},
+ {"trial_end", {"ss_immu", "ss_clin", "inconclu", "i_final", "c_final"}},
+ {"immu_look", {"n", "nobs", "ppn", "ppmax", "draws"}},
+ {"clin_look", {"n", "n_evnt_0", "n_evnt_1", "ppn", "ppmax"}},
+ {"immu_fut", {"n_sero_ctl", "n_sero_trt", "nobs", "ppmax", "thresh"}},
+ {"immu_sup", {"n_sero_ctl", "n_sero_trt", "nobs", "ppn", "thresh"}},
+ {"clin_fut", {"ppmax", "thresh"}},
+ {"clin_sup", {"ppn", "thresh"}},
+ {"immu_final", {"n_sero_ctl", "n_sero_trt", "nobs", "delta", "prob_gt0"}},
+ {"clin_final", {"n", "n_evnt_0", "n_evnt_1", "ratio", "prob_gt1"}}
+};
+
+const char* log_event_name(const int ev){
+ return ev >= 0 && ev < EV_COUNT ? log_events[ev].name : "unknown";
+}
+
+const char* log_field_name(const int ev, const int k){
+ if(ev < 0 || ev >= EV_COUNT || k < 0 || k >= LOG_NX) return nullptr;
+ return log_events[ev].x[k];
+}
+
+const char* log_level_name(const int level){
+ switch(level){
+ case LOG_OFF: return "OFF";
+ case LOG_FATAL: return "FATAL";
+ case LOG_WARN: return "WARN";
+ case LOG_INFO: return "INFO";
+ case LOG_DEBUG: return "DEBUG";
+ case LOG_TRACE: return "TRACE";
+ }
+ return "LEVEL";
+}
+
+// -1 when name is not a level
+int log_level_from_name(const std::string& name){
+ static const int levels[] = {LOG_OFF, LOG_FATAL, LOG_WARN, LOG_INFO,
+                              LOG_DEBUG, LOG_TRACE};
+ for(int l : levels){
+   if(name == log_level_name(l)) return l;
+ }
+ return -1;
+}
+
+
+// single producer (the owning thread), single consumer (the drain)
+// ring. head and tail only grow, the slot is the low bits. they are kept
+// on separate cache lines (padding, as new ignores alignas before c++17).
+struct LogRing {
+ std::atomic<uint64_t> head;
+ char pad_head[56];
+ std::atomic<uint64_t> tail;
+ char pad_tail[56];
+ std::atomic<uint64_t> dropped;
+ LogRec buf[LOG_RING_SIZE];
+
+ LogRing() : head(0), tail(0), dropped(0) {}
+};
+
+// a ring per thread that has raised an event, never freed so that the
+// drain can always read them. threads past LOG_MAX_THREADS drop their
+// events.
+static std::atomic<LogRing*> rings[LOG_MAX_THREADS];
+static std::atomic<int> nrings(0);
+static thread_local LogRing* my_ring = nullptr;
+static thread_local int my_tid = -1;
+static thread_local bool muted = false;
+
+static std::chrono::steady_clock::time_point log_t0;
+
+// the consumer side
+static LogSink* sink = nullptr;
+static bool async = false;
+static std::thread drain_thread;
+static std::mutex drain_mx;
+static std::condition_variable drain_cv;
+static bool drain_stop = false;
+
+
+static LogRing* thread_ring(){
+ if(my_ring || my_tid == LOG_MAX_THREADS) return my_ring;
+ int k = nrings.fetch_add(1);
+ if(k >= LOG_MAX_THREADS){
+   my_tid = LOG_MAX_THREADS;
+   return nullptr;
+ }
+ my_tid = k;
+ my_ring = new LogRing();
+ rings[k].store(my_ring, std::memory_order_release);
+ return my_ring;
+}
+
+void log_push(const int level, const int ev, const int idxsim,
+              const int look, const double* x, const int nx){
+
+ if(muted) return;
+ LogRing* r = thread_ring();
+ if(!r) return;
+
+ uint64_t h = r->head.load(std::memory_order_relaxed);
+ if(h - r->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE){
+   r->dropped.fetch_add(1, std::memory_order_relaxed);
+   return;
+ }
+ LogRec& rec = r->buf[h & (LOG_RING_SIZE - 1)];
+ rec.t_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+   std::chrono::steady_clock::now() - log_t0).count();
+ rec.idxsim = idxsim;
+ rec.look = (int16_t)look;
+ rec.level = (uint8_t)level;
+ rec.ev = (uint8_t)ev;
+ rec.tid = (uint16_t)my_tid;
+ rec.unused = 0;
+ rec.unused2 = 0;
+ for(int k = 0; k < LOG_NX; k++){
+   rec.x[k] = k < nx ? x[k] : 0;
+ }
+ r->head.store(h + 1, std::memory_order_release);
+}
+
+// moves everything in the rings to s, or discards it when s is null
+static void drain(LogSink* s){
+ int n = std::min(nrings.load(), LOG_MAX_THREADS);
+ for(int k = 0; k < n; k++){
+   LogRing* r = rings[k].load(std::memory_order_acquire);
+   if(!r) continue;
+   uint64_t t = r->tail.load(std::memory_order_relaxed);
+   uint64_t h = r->head.load(std::memory_order_acquire);
+   for(; s && t < h; t++){
+     s->write(r->buf[t & (LOG_RING_SIZE - 1)]);
+   }
+   r->tail.store(h, std::memory_order_release);
+   uint64_t nd = r->dropped.exchange(0, std::memory_order_relaxed);
+   if(s && nd > 0){
+     LogRec rec = LogRec();
+     rec.level = LOG_WARN;
+     rec.ev = EV_DROPPED;
+     rec.tid = (uint16_t)k;
+     rec.x[0] = (double)nd;
+     s->write(rec);
+   }
+ }
+}
+
+static void drain_loop(){
+ std::unique_lock<std::mutex> lk(drain_mx);
+ while(!drain_stop){
+   lk.unlock();
+   drain(sink);
+   lk.lock();
+   drain_cv.wait_for(lk, std::chrono::milliseconds(5));
+ }
+}
+
+void log_start(LogSink* s, const int level, const bool as_thread){
+ log_stop();
+ // left overs of events raised while the last log was closing
+ drain(nullptr);
+ sink = s;
+ async = as_thread;
+ log_t0 = std::chrono::steady_clock::now();
+ if(async){
+   drain_stop = false;
+   drain_thread = std::thread(drain_loop);
+ }
+ log_level.store(level, std::memory_order_relaxed);
+}
+
+void log_stop(){
+ log_level.store(LOG_OFF, std::memory_order_relaxed);
+ if(!sink) return;
+ if(async){
+   {
+     std::lock_guard<std::mutex> lk(drain_mx);
+     drain_stop = true;
+   }
+   drain_cv.notify_one();
+   drain_thread.join();
+ }
+ drain(sink);
+ sink->flush();
+ sink = nullptr;
+ async = false;
+}
+
+// a drain thread still running at exit would terminate the process
+static struct LogAtExit {
+ ~LogAtExit(){ log_stop(); }
+} log_at_exit;
+
+void log_pump(){
+ if(sink && !async){
+   drain(sink);
+   sink->flush();
+ }
+}
+
+
+LogMute::LogMute() : was(muted) {
+ muted = true;
+}
+
+LogMute::~LogMute(){
+ muted = was;
+}
+
+
+// sinks
+
+static const char log_magic[8] = {'O', 'R', 'V', 'L', 'O', 'G', '0', '1'};
+
+LogFileSink::LogFileSink(const std::string& path) : path(path) {
+ f = std::fopen(path.c_str(), "wb");
+ if(!f){
+   throw std::runtime_error("log file " + path + ": cannot create");
+ }
+ uint32_t size = sizeof(LogRec);
+ std::fwrite(log_magic, 1, 8, f);
+ std::fwrite(&size, sizeof size, 1, f);
+}
+
+LogFileSink::~LogFileSink(){
+ if(f) std::fclose(f);
+}
+
+void LogFileSink::write(const LogRec& r){
+ std::fwrite(&r, sizeof r, 1, f);
+}
+
+void LogFileSink::flush(){
+ std::fflush(f);
+}
+
+void LogTextSink::write(const LogRec& r){
+ os << log_level_name(r.level) << ": sim = " << r.idxsim << " look " << r.look
+    << " " << log_event_name(r.ev);
+ for(int k = 0; k < LOG_NX; k++){
+   const char* name = log_field_name(r.ev, k);
+   if(!name) break;
+   os << " " << name << " " << r.x[k];
+ }
+ os << "\n";
+}
+
+
+void LogBufferSink::write(const LogRec& r){
+ std::lock_guard<std::mutex> lk(mx);
+ recs.push_back(r);
+}
+
+void LogBufferSink::take(std::vector<LogRec>& out){
+ std::lock_guard<std::mutex> lk(mx);
+ out.insert(out.end(), recs.begin(), recs.end());
+ recs.clear();
+}
+
+
+std::vector<LogRec> log_read(const std::string& path){
+ FILE* f = std::fopen(path.c_str(), "rb");
+ if(!f){
+   throw std::runtime_error("log file " + path + ": cannot open");
+ }
+ char m[8];
+ uint32_t size = 0;
+ if(std::fread(m, 1, 8, f) != 8 || std::memcmp(m, log_magic, 8) != 0 ||
+    std::fread(&size, sizeof size, 1, f) != 1 || size != sizeof(LogRec)){
+   std::fclose(f);
+   throw std::runtime_error("log file " + path + ": not a log from this build");
+ }
+ std::vector<LogRec> recs;
+ LogRec r;
+ while(std::fread(&r, sizeof r, 1, f) == 1){
+   recs.push_back(r);
+ }
+ std::fclose(f);
+ return recs;
+}
@@ -0,0 +1,169 @@
+#ifndef ORVACSIM_EVLOG_H
+#define ORVACSIM_EVLOG_H
+
+// levelled event log for the engine. an event is a fixed size binary
+// record (trial, look, event code and up to LOG_NX statistics) that the
+// thread raising it pushes onto its own lock-free ring without
+// formatting anything. a single consumer drains the rings into a sink,
+// either on its own thread (log_start with async) or when the owner calls
+// log_pump(). a console that may only be written on one thread, such as
+// Rcpp::Rcout, takes an async LogBufferSink and prints it from there. a
+// full ring drops records and counts them, the drops are reported as an
+// EV_DROPPED record. R-free.
+//
+// the binary sink writes
+//
+//   header   "ORVLOG01" | uint32 record size
+//   records  LogRec, in the order drained (per thread in order)
+//
+// host byte order, as written by fwrite. log_read() reads it back.
+//
+// levels are those of futile.logger, as in the cfg logging threshold.
+// an event is only built when its level is within log_level, which is
+// LOG_OFF unless a sink is open, so the cost when off is one relaxed load.
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <initializer_list>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define LOG_OFF           0
+#define LOG_FATAL         1
+#define LOG_WARN          4
+#define LOG_INFO          6
+#define LOG_DEBUG         8
+#define LOG_TRACE         9
+
+#define LOG_NX            5
+#define LOG_RING_SIZE     4096          // records per thread, power of 2
+#define LOG_MAX_THREADS   256
+
+// event codes, see log_events in evlog.cpp for their statistics
+#define EV_DROPPED        0
+#define EV_TRIAL_START    1
+#define EV_TRIAL_END      2
+#define EV_IMMU_LOOK      3
+#define EV_CLIN_LOOK      4
+#define EV_IMMU_FUT       5
+#define EV_IMMU_SUP       6
+#define EV_CLIN_FUT       7
+#define EV_CLIN_SUP       8
+#define EV_IMMU_FINAL     9
+#define EV_CLIN_FINAL     10
+#define EV_COUNT          11
+
+// laid out without padding so a record can be written as is
+struct LogRec {
+ uint64_t t_ns;             // since log_start
+ int32_t idxsim;
+ int16_t look;
+ uint8_t level;
+ uint8_t ev;
+ uint16_t tid;              // ring (thread) the record came from
+ uint16_t unused;
+ uint32_t unused2;
+ double x[LOG_NX];
+};
+
+static_assert(sizeof(LogRec) == 24 + LOG_NX * 8, "LogRec has padding");
+
+// where drained records go. write is only ever called by the consumer.
+class LogSink {
+public:
+ virtual ~LogSink(){}
+ virtual void write(const LogRec& r) = 0;
+ virtual void flush(){}
+};
+
+// binary records to path, see above. throws std::runtime_error if the
+// file cannot be created.
+class LogFileSink : public LogSink {
+private:
+ std::string path;
+ FILE* f = nullptr;
+
+public:
+ explicit LogFileSink(const std::string& path);
+ ~LogFileSink();
+ LogFileSink(const LogFileSink&) = delete;
+ LogFileSink& operator=(const LogFileSink&) = delete;
+ void write(const LogRec& r) override;
+ void flush() override;
+};
+
+// one line of text per record
+class LogTextSink : public LogSink {
+private:
+ std::ostream& os;
+
+public:
+ explicit LogTextSink(std::ostream& os) : os(os) {}
+ void write(const LogRec& r) override;
+ void flush() override { os.flush(); }
+};
+
+// keeps the records in memory until the owner takes them, for an async
+// log whose output may only be written on the owner's thread (the R
+// console)
+class LogBufferSink : public LogSink {
+private:
+ std::mutex mx;
+ std::vector<LogRec> recs;
+
+public:
+ void write(const LogRec& r) override;
+ // moves the records written so far to the end of out, in order
+ void take(std::vector<LogRec>& out);
+};
+
+extern std::atomic<int> log_level;
+
+// opens the log at level into sink, which must outlive log_stop(). with
+// async a thread drains the rings every few ms, otherwise the caller
+// does so with log_pump(). any open log is stopped first.
+void log_start(LogSink* sink, const int level, const bool async);
+// drains what is left into the sink, flushes it and turns logging off
+void log_stop();
+// drains the rings into the sink on the calling thread. no-op when the
+// log is async or not open.
+void log_pump();
+
+// the slow path of log_ev, pushes the record onto the thread's ring
+void log_push(const int level, const int ev, const int idxsim,
+              const int look, const double* x, const int nx);
+
+// raises event ev of trial idxsim at look with statistics x
+inline void log_ev(const int level, const int ev, const int idxsim,
+                   const int look, std::initializer_list<double> x = {}){
+ if(level <= log_level.load(std::memory_order_relaxed)){
+   log_push(level, ev, idxsim, look, x.begin(), (int)x.size());
+ }
+}
+
+// mutes the calling thread's events while in scope, e.g. to replay
+// stopping rules without repeating their events
+class LogMute {
+private:
+ bool was;
+
+public:
+ LogMute();
+ ~LogMute();
+};
+
+// names for the text and R views
+const char* log_level_name(const int level);
+int log_level_from_name(const std::string& name);
+const char* log_event_name(const int ev);
+// the name of statistic k of event ev, nullptr past the last
+const char* log_field_name(const int ev, const int k);
+
+// every record in the binary log at path, throws std::runtime_error if
+// it is not one
+std::vector<LogRec> log_read(const std::string& path);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef ORVACSIM_LOGRANK_H
+#define ORVACSIM_LOGRANK_H
+
+// two sample logrank statistic by sort and sweep. the number at risk in
+// each group at an event time t is the count of observation times >= t,
+// read off the sorted times by binary search rather than from the dense
+// indicator matrices rcpp_outer used to build. each event contributes
+// its own term (no tie correction), as before. R-free.
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// observed minus expected for group 0 (u) and its variance (v), summed
+// over strata
+struct LogrankStat {
+ double u = 0;
+ double v = 0;
+
+ double z() const { return u / std::pow(v, 0.5); }
+};
+
+// z0/z1 all observation times by group, t0/t1 the event times. the
+// events are visited in the order given.
+inline void logrank_add(LogrankStat& s,
+                        std::vector<double> z0, const std::vector<double>& t0,
+                        std::vector<double> z1, const std::vector<double>& t1){
+
+ std::sort(z0.begin(), z0.end());
+ std::sort(z1.begin(), z1.end());
+
+ double sum0 = 0;
+ double sum1 = 0;
+ double var0 = 0;
+ double var1 = 0;
+
+ for(int i = 0; i < (int)t0.size(); i++){
+   double r0 = (double)(z0.end() - std::lower_bound(z0.begin(), z0.end(), t0[i]));
+   double r1 = (double)(z1.end() - std::lower_bound(z1.begin(), z1.end(), t0[i]));
+   sum0 += r1 / (r0 + r1);
+   var0 += r0 * r1 / std::pow((r0 + r1), 2.0);
+ }
+ for(int i = 0; i < (int)t1.size(); i++){
+   double r0 = (double)(z0.end() - std::lower_bound(z0.begin(), z0.end(), t1[i]));
+   double r1 = (double)(z1.end() - std::lower_bound(z1.begin(), z1.end(), t1[i]));
+   sum1 += r0 / (r0 + r1);
+   var1 += r0 * r1 / std::pow((r0 + r1), 2.0);
+ }
+
+ s.u += sum0 - sum1;
+ s.v += var0 + var1;
+}
+
+#endif
@@ -0,0 +1,85 @@
+// performance counters, see perfctr.h
+
+#include "perfctr.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::atomic<bool> perf_on(false);
+
+static const char* perf_phases[PF_COUNT] = {
+ "trial", "dat", "clin_state", "immu", "immu_post", "immu_ppos", "clin",
+ "clin_ppos", "final"
+};
+
+static const char* perf_counters[PC_COUNT] = {
+ "rgamma", "rbeta", "rbinom", "draw", "look", "alloc", "subj"
+};
+
+const char* perf_phase_name(const int ph){
+ return ph >= 0 && ph < PF_COUNT ? perf_phases[ph] : "unknown";
+}
+
+const char* perf_counter_name(const int pc){
+ return pc >= 0 && pc < PC_COUNT ? perf_counters[pc] : "unknown";
+}
+
+
+// the slots, one for each thread that has recorded anything in the order
+// they first did. static rather than new so that the alignment holds
+// (c++11 new ignores it) and each slot starts a cache line of its own
+// and fills whole lines. threads past PERF_MAX_THREADS record nothing.
+struct alignas(PERF_CACHE_LINE) PerfLine {
+ PerfSlot s;
+};
+
+static_assert(sizeof(PerfLine) % PERF_CACHE_LINE == 0, "PerfLine not padded");
+
+static PerfLine slots[PERF_MAX_THREADS];
+static std::atomic<int> nslots(0);
+static thread_local PerfSlot* my_slot = nullptr;
+static thread_local bool no_slot = false;
+
+static PerfSlot* thread_slot(){
+ if(my_slot || no_slot) return my_slot;
+ int k = nslots.fetch_add(1);
+ if(k >= PERF_MAX_THREADS){
+   no_slot = true;
+   return nullptr;
+ }
+ my_slot = &slots[k].s;
+ return my_slot;
+}
+
+void perf_add_time(const int ph, const uint64_t ns){
+ PerfSlot* s = thread_slot();
+ if(!s) return;
+ s->calls[ph]++;
+ s->ns[ph] += ns;
+}
+
+void perf_add_count(const int pc, const uint64_t n){
+ PerfSlot* s = thread_slot();
+ if(!s) return;
+ s->n[pc] += n;
+}
+
+bool perf_enable(const bool on){
+ return perf_on.exchange(on);
+}
+
+std::vector<PerfSlot> perf_read(){
+ std::vector<PerfSlot> res;
+ int n = std::min(nslots.load(), PERF_MAX_THREADS);
+ for(int k = 0; k < n; k++){
+   res.push_back(slots[k].s);
+ }
+ return res;
+}
+
+void perf_reset(){
+ int n = std::min(nslots.load(), PERF_MAX_THREADS);
+ for(int k = 0; k < n; k++){
+   std::memset(&slots[k].s, 0, sizeof(PerfSlot));
+ }
+}
@@ -0,0 +1,99 @@
+#ifndef ORVACSIM_PERFCTR_H
+#define ORVACSIM_PERFCTR_H
+
+// hot path performance counters for the engine. each phase (PF_) keeps
+// its number of calls and the nanoseconds spent in it, timed inclusive of
+// the phases it calls (PF_TRIAL holds everything). each counter (PC_)
+// counts an event such as a gamma draw. every thread that records
+// anything gets its own slot, padded to whole cache lines (see
+// perfctr.cpp) so the workers and draw threads never share one, and the
+// slots are read (perf_read) or zeroed (perf_reset) between runs. R-free.
+//
+// nothing is recorded until perf_enable(true). off, a timer or a count
+// costs one relaxed load and a branch.
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// phases
+#define PF_TRIAL          0             // sim_dotrial
+#define PF_DAT            1             // sim_dat_enrol, sim_dat_outcomes
+#define PF_CLIN_STATE     2             // sim_clin_set_state, ClinTally::update
+#define PF_IMMU           3             // sim_immu
+#define PF_IMMU_POST      4             // sim_immu_interim_post
+#define PF_IMMU_PPOS      5             // sim_immu_ppos_test
+#define PF_CLIN           6             // sim_clin
+#define PF_CLIN_PPOS      7             // the predictive draws of sim_clin
+#define PF_FINAL          8             // immu_final, clin_final
+#define PF_COUNT          9
+
+// counters
+#define PC_RGAMMA         0             // including those of rbeta
+#define PC_RBETA          1             // including those of rbinom
+#define PC_RBINOM         2
+#define PC_DRAW           3             // predictive draws, immu and clin
+#define PC_LOOK           4             // looks the trial rules evaluated
+#define PC_ALLOC          5             // workspace buffers (re)allocated
+#define PC_SUBJ           6             // subjects given outcomes
+#define PC_COUNT          7
+
+#define PERF_MAX_THREADS  256
+#define PERF_CACHE_LINE   64
+
+// one thread's totals
+struct PerfSlot {
+ uint64_t calls[PF_COUNT];
+ uint64_t ns[PF_COUNT];
+ uint64_t n[PC_COUNT];
+};
+
+extern std::atomic<bool> perf_on;
+
+// starts or stops recording, returns whether it was on
+bool perf_enable(const bool on);
+// a copy of each thread's slot, in the order the threads first recorded.
+// only consistent between runs.
+std::vector<PerfSlot> perf_read();
+// zeroes every slot, between runs only
+void perf_reset();
+
+// the slow paths, add to the calling thread's slot
+void perf_add_time(const int ph, const uint64_t ns);
+void perf_add_count(const int pc, const uint64_t n);
+
+inline void perf_count(const int pc, const uint64_t n = 1){
+ if(perf_on.load(std::memory_order_relaxed)){
+   perf_add_count(pc, n);
+ }
+}
+
+// times phase ph while in scope
+class PerfTimer {
+private:
+ int ph;
+ bool on;
+ std::chrono::steady_clock::time_point t0;
+
+public:
+ explicit PerfTimer(const int ph) :
+   ph(ph), on(perf_on.load(std::memory_order_relaxed)) {
+   if(on) t0 = std::chrono::steady_clock::now();
+ }
+ ~PerfTimer(){
+   if(on){
+     perf_add_time(ph, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+       std::chrono::steady_clock::now() - t0).count());
+   }
+ }
+ PerfTimer(const PerfTimer&) = delete;
+ PerfTimer& operator=(const PerfTimer&) = delete;
+};
+
+// names for the R and cli views
+const char* perf_phase_name(const int ph);
+const char* perf_counter_name(const int pc);
+
+#endif
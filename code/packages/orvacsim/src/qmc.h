@@ -0,0 +1,150 @@
+#ifndef ORVACSIM_QMC_H
+#define ORVACSIM_QMC_H
+
+// variance reduced uniforms for the predictive draws (cfg pp_mc). the
+// leading coordinates of draw i, the posterior parameters and for immu
+// the predictive counts, come from point i of a randomised low
+// discrepancy sequence or an antithetic pair and go through the inverse
+// cdf samplers in specfun.h. whatever else a draw needs (the imputed
+// event times) comes from its substream as before. R-free.
+//
+//   PP_MC_PLAIN       pseudo random, the samplers of rng.h
+//   PP_MC_ANTITHETIC  draws 2k and 2k + 1 share a substream, the second
+//                     with every uniform u replaced by 1 - u
+//   PP_MC_SOBOL       sobol points (joe and kuo direction numbers) with a
+//                     random digital shift per coordinate
+//   PP_MC_HALTON      halton points with a random (cranley-patterson)
+//                     rotation per coordinate
+//
+// the randomisation is drawn from a reserved substream of the stream the
+// draws use so the estimates stay unbiased and reproducible, and point i
+// is computed from i alone so any thread can produce any draw.
+
+#include <cstdint>
+#include <cmath>
+#include "config.h"
+#include "rng.h"
+
+#define QMC_MAXDIM          8
+#define QMC_SHIFT_SUBSTREAM 0xFFFFFFFFu
+
+namespace qmc {
+
+// direction numbers v[d][k] (bit k of the index) for the first
+// QMC_MAXDIM sobol coordinates, from the primitive polynomials and
+// initial m of joe and kuo (2008)
+struct SobolTable {
+ uint32_t v[QMC_MAXDIM][32];
+
+ SobolTable(){
+   static const int s[QMC_MAXDIM] = {0, 1, 2, 3, 3, 4, 4, 5};
+   static const int a[QMC_MAXDIM] = {0, 0, 1, 1, 2, 1, 4, 2};
+   static const int m[QMC_MAXDIM][5] = {
+     {0}, {1}, {1, 3}, {1, 3, 1}, {1, 1, 1},
+     {1, 1, 3, 3}, {1, 3, 5, 13}, {1, 1, 5, 5, 17}
+   };
+   for(int k = 0; k < 32; k++){
+     v[0][k] = 1u << (31 - k);
+   }
+   for(int d = 1; d < QMC_MAXDIM; d++){
+     uint32_t mk[32];
+     for(int k = 0; k < 32; k++){
+       if(k < s[d]){
+         mk[k] = (uint32_t)m[d][k];
+         continue;
+       }
+       mk[k] = mk[k - s[d]] ^ (mk[k - s[d]] << s[d]);
+       for(int j = 1; j < s[d]; j++){
+         if((a[d] >> (s[d] - 1 - j)) & 1){
+           mk[k] ^= mk[k - j] << j;
+         }
+       }
+     }
+     for(int k = 0; k < 32; k++){
+       v[d][k] = mk[k] << (31 - k);
+     }
+   }
+ }
+};
+
+inline const SobolTable& sobol_table(){
+ static const SobolTable t;
+ return t;
+}
+
+// coordinate d of sobol point i as 32 bits
+inline uint32_t sobol_bits(uint32_t i, const int d){
+ const uint32_t* v = sobol_table().v[d];
+ uint32_t x = 0;
+ for(int k = 0; i != 0; k++, i >>= 1){
+   if(i & 1) x ^= v[k];
+ }
+ return x;
+}
+
+// coordinate d of halton point i, radical inverse in the d'th prime
+inline double halton(uint32_t i, const int d){
+ static const int base[QMC_MAXDIM] = {2, 3, 5, 7, 11, 13, 17, 19};
+ int b = base[d];
+ double f = 1;
+ double x = 0;
+ while(i > 0){
+   f /= b;
+   x += f * (i % b);
+   i /= b;
+ }
+ return x;
+}
+
+}
+
+
+// the uniforms of one predictive loop. construct from the stream the
+// draws use then per draw take rng(i) and the leading coordinates u(i, d).
+class PpUnif {
+private:
+ int method;
+ Rng base;
+ uint32_t shift[QMC_MAXDIM];
+ double rot[QMC_MAXDIM];
+
+public:
+ PpUnif(const int method, const Rng& stream) :
+   method(method),
+   base(stream) {
+   Rng r = stream.substream(QMC_SHIFT_SUBSTREAM);
+   for(int d = 0; d < QMC_MAXDIM; d++){
+     shift[d] = method == PP_MC_SOBOL ? r.next_u32() : 0;
+     rot[d] = method == PP_MC_HALTON ? r.unif() : 0;
+   }
+ }
+
+ // true when the leading coordinates go through the inverse cdfs
+ bool inverse() const { return method != PP_MC_PLAIN; }
+
+ // the rng for the rest of draw i
+ Rng rng(const int i) const {
+   if(method == PP_MC_ANTITHETIC){
+     Rng r = base.substream((uint32_t)(i & ~1));
+     return (i & 1) ? r.mirror() : r;
+   }
+   return base.substream((uint32_t)i);
+ }
+
+ // coordinate d < QMC_MAXDIM of draw i, open (0, 1). r is the rng from
+ // rng(i), used when the method has no point set.
+ double u(const int i, const int d, Rng& r) const {
+   if(method == PP_MC_SOBOL){
+     uint32_t x = qmc::sobol_bits((uint32_t)i, d) ^ shift[d];
+     return ((double)x + 0.5) / 4294967296.0;
+   }
+   if(method == PP_MC_HALTON){
+     double x = qmc::halton((uint32_t)i, d) + rot[d];
+     x -= std::floor(x);
+     return x > 0 ? x : 0.5 / 4294967296.0;
+   }
+   return r.unif();
+ }
+};
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef ORVACSIM_RESFILE_H
+#define ORVACSIM_RESFILE_H
+
+// columnar results file for long batch runs. a header holding the schema
+// is followed by chunks of rows, each chunk storing its columns one after
+// the other:
+//
+//   header  "ORVRES02" | uint32 seed | uint64 cfg hash | uint32 ncol
+//           | ncol x (uint8 type, uint32 len, name)
+//   chunk   uint32 RES_CHUNK | uint32 nrow | columns | uint32 RES_CHUNK_END
+//
+// int columns are int32 and double columns float64, host byte order. a
+// chunk only counts once its end marker is on disk so a run that dies
+// mid write loses at most the chunk in progress; ResWriter drops such a
+// torn tail when it reopens the file. the first column is the trial
+// index (idxsim) that resumed runs skip. the seed and cfg hash (see
+// SimConfig::result_hash) identify the design the rows belong to, a run
+// under another design refuses to resume the file. R-free.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#define RES_INT           0
+#define RES_DBL           1
+#define RES_CHUNK         0x4b4e4843u   // "CHNK"
+#define RES_CHUNK_END     0x444e4543u   // "CEND"
+
+struct ResColumn {
+ std::string name;
+ uint8_t type;
+};
+
+// the design a file's rows were simulated under
+struct ResKey {
+ uint32_t seed = 0;
+ uint64_t cfg = 0;
+};
+
+// whole file in memory, one vector per column (by type, in schema order)
+struct ResTable {
+ ResKey key;
+ std::vector<ResColumn> cols;
+ std::vector< std::vector<int32_t> > icol;
+ std::vector< std::vector<double> > dcol;
+ int nrow = 0;
+};
+
+namespace resfile {
+
+static const char magic[8] = {'O', 'R', 'V', 'R', 'E', 'S', '0', '2'};
+
+template <typename T>
+inline bool get(FILE* f, T& x){
+ return std::fread(&x, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+inline void put(FILE* f, const T& x){
+ std::fwrite(&x, sizeof(T), 1, f);
+}
+
+inline void fail(const std::string& path, const std::string& msg){
+ throw std::runtime_error("results file " + path + ": " + msg);
+}
+
+inline void write_header(FILE* f, const ResKey& key,
+                         const std::vector<ResColumn>& cols){
+ std::fwrite(magic, 1, 8, f);
+ put(f, key.seed);
+ put(f, key.cfg);
+ put(f, (uint32_t)cols.size());
+ for(const ResColumn& c : cols){
+   put(f, c.type);
+   put(f, (uint32_t)c.name.size());
+   std::fwrite(c.name.data(), 1, c.name.size(), f);
+ }
+}
+
+// appends nrow rows from the column buffers, starting at row off
+inline void write_chunk(FILE* f, const ResTable& t, const int off, const int nrow){
+ put(f, (uint32_t)RES_CHUNK);
+ put(f, (uint32_t)nrow);
+ int ki = 0;
+ int kd = 0;
+ for(const ResColumn& c : t.cols){
+   if(c.type == RES_INT){
+     std::fwrite(t.icol[ki++].data() + off, sizeof(int32_t), nrow, f);
+   } else {
+     std::fwrite(t.dcol[kd++].data() + off, sizeof(double), nrow, f);
+   }
+ }
+ put(f, (uint32_t)RES_CHUNK_END);
+}
+
+}
+
+// reads the schema and every complete chunk. torn is set when bytes
+// follow the last complete chunk. throws if the header is unreadable.
+inline ResTable res_read(const std::string& path, bool* torn = nullptr){
+
+ FILE* f = std::fopen(path.c_str(), "rb");
+ if(!f) resfile::fail(path, "cannot open");
+
+ ResTable t;
+ char m[8];
+ uint32_t ncol = 0;
+ if(std::fread(m, 1, 8, f) != 8 || std::memcmp(m, resfile::magic, 8) != 0 ||
+    !resfile::get(f, t.key.seed) || !resfile::get(f, t.key.cfg) ||
+    !resfile::get(f, ncol)){
+   std::fclose(f);
+   resfile::fail(path, "not a results file");
+ }
+ for(uint32_t j = 0; j < ncol; j++){
+   ResColumn c;
+   uint32_t len = 0;
+   if(!resfile::get(f, c.type) || !resfile::get(f, len) || len > 1024){
+     std::fclose(f);
+     resfile::fail(path, "bad schema");
+   }
+   c.name.resize(len);
+   if(len > 0 && std::fread(&c.name[0], 1, len, f) != len){
+     std::fclose(f);
+     resfile::fail(path, "bad schema");
+   }
+   if(c.type == RES_INT) t.icol.emplace_back(); else t.dcol.emplace_back();
+   t.cols.push_back(c);
+ }
+
+ bool complete = true;
+ for(;;){
+   uint32_t tag = 0;
+   uint32_t nrow = 0;
+   if(!resfile::get(f, tag)) break;
+   if(tag != RES_CHUNK || !resfile::get(f, nrow)){
+     complete = false;
+     break;
+   }
+   size_t ki = 0;
+   size_t kd = 0;
+   bool ok = true;
+   for(const ResColumn& c : t.cols){
+     if(c.type == RES_INT){
+       std::vector<int32_t>& v = t.icol[ki++];
+       v.resize(t.nrow + nrow);
+       ok = ok && std::fread(v.data() + t.nrow, sizeof(int32_t), nrow, f) == nrow;
+     } else {
+       std::vector<double>& v = t.dcol[kd++];
+       v.resize(t.nrow + nrow);
+       ok = ok && std::fread(v.data() + t.nrow, sizeof(double), nrow, f) == nrow;
+     }
+     if(!ok) break;
+   }
+   uint32_t end = 0;
+   if(!ok || !resfile::get(f, end) || end != RES_CHUNK_END){
+     complete = false;
+     break;
+   }
+   t.nrow += nrow;
+ }
+ std::fclose(f);
+
+ // drop whatever a torn chunk left in the buffers
+ for(std::vector<int32_t>& v : t.icol) v.resize(t.nrow);
+ for(std::vector<double>& v : t.dcol) v.resize(t.nrow);
+ if(torn) *torn = !complete;
+ return t;
+}
+
+
+// buffers rows and appends them to the file a chunk at a time. opening an
+// existing file with the same key and schema resumes it: done() lists the
+// trial indices already there.
+class ResWriter {
+private:
+ std::string path;
+ FILE* f = nullptr;
+ ResTable buf;
+ std::vector<int> done_idx;
+
+public:
+ ResWriter(const std::string& path, const ResKey& key,
+           const std::vector<ResColumn>& cols) :
+   path(path) {
+
+   if(cols.empty() || cols[0].type != RES_INT){
+     resfile::fail(path, "the first column must be the int trial index");
+   }
+   buf.key = key;
+   buf.cols = cols;
+   for(const ResColumn& c : cols){
+     if(c.type == RES_INT) buf.icol.emplace_back(); else buf.dcol.emplace_back();
+   }
+
+   FILE* probe = std::fopen(path.c_str(), "rb");
+   if(!probe){
+     f = std::fopen(path.c_str(), "wb");
+     if(!f) resfile::fail(path, "cannot create");
+     resfile::write_header(f, key, cols);
+     std::fflush(f);
+     return;
+   }
+   std::fclose(probe);
+
+   bool torn = false;
+   ResTable old = res_read(path, &torn);
+   if(old.key.seed != key.seed){
+     resfile::fail(path, "written under seed " + std::to_string(old.key.seed) +
+                   ", not " + std::to_string(key.seed));
+   }
+   if(old.key.cfg != key.cfg){
+     resfile::fail(path, "written under a different cfg");
+   }
+   if(old.cols.size() != cols.size()){
+     resfile::fail(path, "schema differs from this build");
+   }
+   for(size_t j = 0; j < cols.size(); j++){
+     if(old.cols[j].name != cols[j].name || old.cols[j].type != cols[j].type){
+       resfile::fail(path, "schema differs from this build");
+     }
+   }
+   done_idx = old.icol[0];
+   std::sort(done_idx.begin(), done_idx.end());
+
+   if(torn){
+     // the complete chunks go to a copy that then replaces the file, so
+     // the rows already on disk survive a failure during the rewrite
+     std::string tmp = path + ".tmp";
+     FILE* g = std::fopen(tmp.c_str(), "wb");
+     if(!g) resfile::fail(tmp, "cannot create");
+     resfile::write_header(g, key, cols);
+     if(old.nrow > 0) resfile::write_chunk(g, old, 0, old.nrow);
+     bool ok = std::fflush(g) == 0 && !std::ferror(g);
+     ok = std::fclose(g) == 0 && ok;
+     if(!ok){
+       std::remove(tmp.c_str());
+       resfile::fail(tmp, "write failed");
+     }
+     // windows will not rename over an existing file
+     if(std::rename(tmp.c_str(), path.c_str()) != 0 &&
+        (std::remove(path.c_str()) != 0 ||
+         std::rename(tmp.c_str(), path.c_str()) != 0)){
+       resfile::fail(path, "cannot replace with " + tmp);
+     }
+   }
+   f = std::fopen(path.c_str(), "ab");
+   if(!f) resfile::fail(path, "cannot append");
+ }
+
+ ~ResWriter(){
+   if(f){
+     try {
+       flush();
+     } catch(std::exception&){
+     }
+     std::fclose(f);
+   }
+ }
+
+ ResWriter(const ResWriter&) = delete;
+ ResWriter& operator=(const ResWriter&) = delete;
+
+ // sorted trial indices present when the file was opened
+ const std::vector<int>& done() const { return done_idx; }
+
+ bool is_done(const int idx) const {
+   return std::binary_search(done_idx.begin(), done_idx.end(), idx);
+ }
+
+ // one row, ints and dbls in schema order within each type
+ void add(const int32_t* ints, const double* dbls){
+   for(size_t k = 0; k < buf.icol.size(); k++) buf.icol[k].push_back(ints[k]);
+   for(size_t k = 0; k < buf.dcol.size(); k++) buf.dcol[k].push_back(dbls[k]);
+   buf.nrow++;
+ }
+
+ // writes the buffered rows as one chunk and hands them to the os
+ void flush(){
+   if(buf.nrow == 0) return;
+   resfile::write_chunk(f, buf, 0, buf.nrow);
+   if(std::fflush(f) != 0 || std::ferror(f)){
+     resfile::fail(path, "write failed");
+   }
+   for(std::vector<int32_t>& v : buf.icol) v.clear();
+   for(std::vector<double>& v : buf.dcol) v.clear();
+   buf.nrow = 0;
+ }
+};
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef ORVACSIM_RNG_H
+#define ORVACSIM_RNG_H
+
+// counter based random number streams for the trial engine.
+//
+// every draw is a pure function of (seed, idxsim, stream, substream, position)
+// so a trial gives the same numbers whichever thread runs it and however
+// many other trials run alongside it. the block generator is philox4x32-10
+// (salmon et al. 2011, random123) and the samplers follow the R
+// parameterisations (scale not rate) so call sites read like the R:: ones.
+//
+// the engine is a template parameter so another counter based generator
+// can be dropped in - it needs a constructor taking (key, stream, substream)
+// and operator() returning the next uint32.
+//
+// the gamma, beta and binomial samplers count their draws (perfctr.h).
+
+#include <cstdint>
+#include <cmath>
+
+#include "perfctr.h"
+
+// stream tags, one per distinct use of random numbers within a trial
+#define STREAM_DAT          1
+#define STREAM_IMMU_POST    2
+#define STREAM_IMMU_PPOS_N  3
+#define STREAM_IMMU_PPOS_MAX 4
+#define STREAM_CLIN         5
+#define STREAM_FINAL_IMMU   6
+#define STREAM_FINAL_CLIN   7
+#define STREAM_USER         8
+
+
+class Philox4x32 {
+private:
+ uint32_t key[2];
+ uint32_t ctr[4];
+ uint32_t out[4];
+ int pos = 4;
+
+ static inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo){
+   uint64_t p = (uint64_t)a * (uint64_t)b;
+   hi = (uint32_t)(p >> 32);
+   lo = (uint32_t)p;
+ }
+
+ void block(){
+   uint32_t k0 = key[0];
+   uint32_t k1 = key[1];
+   uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+   uint32_t hi0, lo0, hi1, lo1;
+   for(int r = 0; r < 10; r++){
+     mulhilo(0xD2511F53u, c0, hi0, lo0);
+     mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+     c0 = hi1 ^ c1 ^ k0;
+     c1 = lo1;
+     c2 = hi0 ^ c3 ^ k1;
+     c3 = lo0;
+     k0 += 0x9E3779B9u;
+     k1 += 0xBB67AE85u;
+   }
+   out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+   // the low 64 bits of the counter index blocks within a (sub)stream
+   if(++ctr[0] == 0) ++ctr[1];
+   pos = 0;
+ }
+
+public:
+ // key identifies the trial, stream/substream pick an independent sequence
+ // for that trial.
+ Philox4x32(const uint64_t k, const uint32_t stream, const uint32_t substream){
+   key[0] = (uint32_t)k;
+   key[1] = (uint32_t)(k >> 32);
+   ctr[0] = 0;
+   ctr[1] = 0;
+   ctr[2] = stream;
+   ctr[3] = substream;
+ }
+
+ inline uint32_t operator()(){
+   if(pos == 4) block();
+   return out[pos++];
+ }
+};
+
+
+template <typename Engine>
+class RngT {
+private:
+ uint64_t k;
+ uint32_t strm;
+ Engine eng;
+ // all ones for the antithetic twin (see mirror), every uniform u then
+ // comes out as exactly 1 - u
+ uint32_t flip = 0;
+ bool has_spare = false;
+ double spare = 0;
+
+ // binomial by inversion, cheap while n * p is small
+ int rbinom_inv(int n, double p){
+   double q = 1 - p;
+   double s = p / q;
+   double a = (n + 1) * s;
+   double r = std::pow(q, (double)n);
+   double u = unif();
+   int x = 0;
+   while(u > r && x < n){
+     u -= r;
+     x++;
+     r *= (a / x - s);
+   }
+   return x;
+ }
+
+ // exact binomial. inversion when n * min(p, 1-p) is small otherwise
+ // devroye's beta recursion (the a'th order statistic of n uniforms is
+ // beta(a, n - a + 1)) halves n until inversion is cheap.
+ int rbinom_rec(const int n, const double p){
+   if(n <= 0 || p <= 0) return 0;
+   if(p >= 1) return n;
+   if(p > 0.5) return n - rbinom_rec(n, 1 - p);
+   if(n * p < 20) return rbinom_inv(n, p);
+   int a = 1 + n / 2;
+   double b = rbeta(a, n + 1 - a);
+   if(b >= p) return rbinom_rec(a - 1, p / b);
+   return a + rbinom_rec(n - a, (p - b) / (1 - b));
+ }
+
+ RngT(const uint64_t key, const uint32_t stream, const uint32_t substream,
+      const uint32_t flip) :
+   k(key),
+   strm(stream),
+   eng(key, stream, substream),
+   flip(flip) {}
+
+public:
+ // seed comes from cfg, idxsim is the trial. the (seed, idxsim) pair is
+ // the philox key so distinct trials never share numbers.
+ RngT(const uint32_t seed, const uint32_t idxsim,
+      const uint32_t stream = 0, const uint32_t substream = 0) :
+   k(((uint64_t)seed << 32) | (uint64_t)idxsim),
+   strm(stream),
+   eng(k, stream, substream) {}
+
+ // independent stream for one use (tag) at one look, e.g.
+ // rng.stream(STREAM_CLIN, look)
+ RngT stream(const uint32_t tag, const uint32_t look) const {
+   return RngT(k, (tag << 24) | (look & 0x00FFFFFFu), 0, flip);
+ }
+
+ // independent substream of this stream, e.g. one per posterior draw or
+ // per subject
+ RngT substream(const uint32_t i) const {
+   return RngT(k, strm, i, flip);
+ }
+
+ // the antithetic twin, continuing from the current position
+ RngT mirror() const {
+   RngT r(*this);
+   r.flip = ~flip;
+   return r;
+ }
+
+ inline uint32_t next_u32(){ return eng() ^ flip; }
+
+ // uniform on the open interval (0, 1) with 53 bits of precision
+ inline double unif(){
+   uint32_t a = next_u32() >> 5;
+   uint32_t b = next_u32() >> 6;
+   return ((double)a * 67108864.0 + (double)b + 0.5) / 9007199254740992.0;
+ }
+
+ inline double runif(const double a, const double b){
+   return a + (b - a) * unif();
+ }
+
+ // standard normal, marsaglia polar method
+ double rnorm(){
+   if(has_spare){
+     has_spare = false;
+     return spare;
+   }
+   double u, v, s;
+   do {
+     u = 2 * unif() - 1;
+     v = 2 * unif() - 1;
+     s = u * u + v * v;
+   } while(s >= 1 || s == 0);
+   s = std::sqrt(-2 * std::log(s) / s);
+   spare = v * s;
+   has_spare = true;
+   return u * s;
+ }
+
+ inline double rexp(const double scale){
+   return -std::log(unif()) * scale;
+ }
+
+ // marsaglia and tsang (2000), shape < 1 via the boost x * u^(1/shape)
+ double rgamma(const double shape, const double scale){
+   if(shape <= 0) return 0;
+   if(shape < 1){
+     double u = unif();
+     return rgamma(1 + shape, scale) * std::pow(u, 1 / shape);
+   }
+   perf_count(PC_RGAMMA);
+   double d = shape - 1.0 / 3.0;
+   double c = 1 / std::sqrt(9 * d);
+   for(;;){
+     double x, v;
+     do {
+       x = rnorm();
+       v = 1 + c * x;
+     } while(v <= 0);
+     v = v * v * v;
+     double u = unif();
+     double x2 = x * x;
+     if(u < 1 - 0.0331 * x2 * x2) return d * v * scale;
+     if(std::log(u) < 0.5 * x2 + d * (1 - v + std::log(v))) return d * v * scale;
+   }
+ }
+
+ inline double rbeta(const double a, const double b){
+   perf_count(PC_RBETA);
+   double x = rgamma(a, 1);
+   double y = rgamma(b, 1);
+   return x / (x + y);
+ }
+
+ // exact binomial, see rbinom_rec
+ int rbinom(const int n, const double p){
+   perf_count(PC_RBINOM);
+   return rbinom_rec(n, p);
+ }
+};
+
+typedef RngT<Philox4x32> Rng;
+
+#endif
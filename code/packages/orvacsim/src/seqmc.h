@@ -0,0 +1,54 @@
+#ifndef ORVACSIM_SEQMC_H
+#define ORVACSIM_SEQMC_H
+
+// sequential stopping of the predictive draws (cfg pp_adaptive). the draws
+// run in batches and after each one the win proportion's score interval
+// is compared with the threshold the decision uses. once the interval is
+// clear of it the draws stop. alpha is split evenly over the checks a
+// decision may make so that the probability that more draws would have
+// flipped it is at most alpha. R-free.
+
+#include <cmath>
+
+// upper alpha point of the standard normal, newton on erfc
+inline double qnorm_upper(const double alpha){
+ double z = 2;
+ for(int i = 0; i < 50; i++){
+   double f = 0.5 * std::erfc(z / std::sqrt(2.0)) - alpha;
+   double dens = std::exp(-0.5 * z * z) / std::sqrt(2 * M_PI);
+   double step = f / dens;
+   z += step;
+   if(std::fabs(step) < 1e-12) break;
+ }
+ return z;
+}
+
+// z for each of the checks made after every batch of up to ndraw draws,
+// bonferroni over the ceil(ndraw / batch) of them
+inline double seq_z(const double alpha, const int ndraw, const int batch){
+ int nchecks = (ndraw + batch - 1) / batch;
+ return qnorm_upper(alpha / nchecks);
+}
+
+// wilson score interval for win successes out of n at z
+struct WinBound {
+ double lwr;
+ double upr;
+
+ WinBound(const int win, const int n, const double z){
+   double p = (double)win / n;
+   double z2 = z * z;
+   double mid = (p + z2 / (2 * n)) / (1 + z2 / n);
+   double half = z / (1 + z2 / n) * std::sqrt(p * (1 - p) / n + z2 / (4.0 * n * n));
+   lwr = mid - half;
+   upr = mid + half;
+ }
+
+ // the interval lies wholly on one side of thresh. false for a nan
+ // thresh, which never settles.
+ bool clear_of(const double thresh) const {
+   return upr < thresh || lwr > thresh;
+ }
+};
+
+#endif
@@ -1,9 +1,9 @@
-
 #include <RcppDist.h>
 // [[Rcpp::depends(RcppDist)]]
 
-#include <cmath>
-#include <algorithm>
+#include <memory>
+
+#include "engine.h"
 
 // ese Makevars
 // compiler flags
@@ -15,53 +15,75 @@
 
 //#include <mcmc.hpp>
 
-// column indices
-#define COL_ID            0
-#define COL_TRT           1
-#define COL_ACCRT         2
-#define COL_AGE           3
-#define COL_SEROT2        4
-#define COL_SEROT3        5
-#define COL_PROBT3        6
-#define COL_EVTT          7
-#define COL_FU1           8
-#define COL_FU2           9
-#define COL_CEN           10
-#define COL_OBST          11
-#define COL_REASON        12
-#define COL_IMPUTE        13
-#define COL_REFTIME       14
-#define NCOL              15
-
-#define COL_THETA0        0
-#define COL_THETA1        1
-#define COL_DELTA         2
-
-#define COL_LAMB0         0
-#define COL_LAMB1         1
-#define COL_RATIO         2
-
-
-
-#define _DEBUG 0
-
-#if _DEBUG
-#define DBG( os, msg )                                \
-(os) << "DBG: " << __FILE__ << "(" << __LINE__ << ") "\
- << msg << std::endl
-#else
-#define DBG( os, msg )
-#endif
-
-#define _INFO  1
-
-#if _INFO
-#define INFO( os, i, msg )                                \
-(os) << "INFO: " << __FILE__ << "(" << __LINE__ << ") "\
-    << " sim = " << i << " " << msg << std::endl
-#else
-#define INFO( os, i, msg )
-#endif
+
+// the R side of the engine (engine.h): the rcpp_ exports read the sim_cfg()
+// list and the trial matrix into the engine types, run it and convert the
+// results back to R objects.
+
+// the event log sink opened by rcpp_log, if any. the console log drains
+// into r_log_buf on the log's own thread so that its rings cannot fill
+// while R's thread is busy, and R's thread prints it (r_log_print).
+static std::unique_ptr<LogSink> r_log_sink;
+static LogBufferSink* r_log_buf = nullptr;
+
+// on R's thread, prints what the console log has gathered
+static void r_log_print(){
+ if(!r_log_buf) return;
+ std::vector<LogRec> recs;
+ r_log_buf->take(recs);
+ LogTextSink out(Rcpp::Rcout);
+ for(const LogRec& r : recs){
+   out.write(r);
+ }
+ out.flush();
+}
+
+// the log's sink and buffer go, the log must be stopped
+static void r_log_reset(){
+ r_log_print();
+ r_log_buf = nullptr;
+ r_log_sink.reset();
+}
+
+// between trials on R's thread, print what the console log has gathered
+// and let R interrupt
+static void r_poll(){
+ r_log_print();
+ Rcpp::checkUserInterrupt();
+}
+
+// engine output and interrupts go through R
+static struct EngineHooks {
+ EngineHooks(){
+   log_os = &Rcpp::Rcout;
+   user_interrupt = &r_poll;
+ }
+ // before r_log_sink goes
+ ~EngineHooks(){
+   log_stop();
+ }
+} engine_hooks;
+
+// prints the console log's records when the export returns
+struct LogPumpOnExit {
+ ~LogPumpOnExit(){ r_log_print(); }
+};
+
+
+// the scenarios of a grid, one cfg per row of the grid data.frame
+struct ScenarioGrid {
+ std::vector<std::string> axes;
+ std::vector< std::vector<double> > vals;
+ std::vector<SimConfig> scen;
+
+ ScenarioGrid(const SimConfig& base, const Rcpp::List& grid);
+ int nscen() const { return (int)scen.size(); }
+ Rcpp::List results(const std::vector<TrialResult>& res, const int nsims) const;
+};
+
+
+
+
 
 // function prototypes
 
@@ -72,7 +94,11 @@ Rcpp::List rcpp_clin(arma::mat& d, const Rcpp::List& cfg,
 Rcpp::List rcpp_clin_set_state(arma::mat& d, const int look,
                               const double fu,
                               const Rcpp::List& cfg, const int idxsim);
-
+Rcpp::List rcpp_clin_suffstat(const arma::mat& d, const int look,
+                             const double fu,
+                             const Rcpp::List& cfg);
+Rcpp::List rcpp_clin_tally(arma::mat& d, const Rcpp::IntegerVector& looks,
+                          const Rcpp::List& cfg);
 
 Rcpp::List rcpp_immu(const arma::mat& d, const Rcpp::List& cfg,
                      const int look);
@@ -108,6 +134,10 @@ Rcpp::List rcpp_immu_ppos_test(const arma::mat& d,
 Rcpp::List rcpp_logrank(const arma::mat& d,
                        const int look,
                        const Rcpp::List& cfg);
+Rcpp::List rcpp_logrank_strat(const arma::mat& d,
+                             const int look,
+                             const Rcpp::IntegerVector& strata,
+                             const Rcpp::List& cfg);
 void rcpp_outer(const arma::vec& z,
                const arma::vec& t,
                arma::mat& out);
@@ -118,133 +148,243 @@ arma::mat rcpp_test_2(const arma::mat& d) ;
 arma::mat rcpp_test_sub_2(arma::mat& d);
 Rcpp::List rcpp_dotrial(const int idxsim, const Rcpp::List& cfg,
                        const bool rtn_trial_dat);
+Rcpp::List rcpp_dotrial_batch(const int nsims, const Rcpp::List& cfg,
+                             const int nthreads);
+int rcpp_dotrial_batch_file(const int nsims, const Rcpp::List& cfg,
+                            const int nthreads, const std::string& path,
+                            const int flush_every);
+Rcpp::List rcpp_read_results(const std::string& path);
+Rcpp::List rcpp_dotrial_grid(const int nsims, const Rcpp::List& cfg,
+                             const Rcpp::List& grid, const int nthreads);
+Rcpp::List rcpp_dotrial_thresh(const int nsims, const Rcpp::List& cfg,
+                               const Rcpp::List& thresh, const int nthreads);
+bool replay_axis(const std::string& name);
+int rcpp_trace_file(const int nsims, const Rcpp::List& cfg,
+                    const int nthreads, const std::string& path);
+Rcpp::List rcpp_trace_replay(const std::string& path, const Rcpp::List& cfg,
+                             const Rcpp::List& rules);
+Rcpp::List rcpp_read_trace(const std::string& path);
+void rcpp_log(const std::string& path, const std::string& level);
+void rcpp_log_close();
+Rcpp::List rcpp_read_log(const std::string& path);
+bool rcpp_perf_enable(const bool on);
+Rcpp::List rcpp_perf_counters(const bool reset);
+Rcpp::List table_to_df(const ResTable& t);
+
+SimConfig read_cfg(const Rcpp::List& cfg);
+uint32_t cfg_seed(const Rcpp::List& cfg);
+Rng rng_from_r();
+Rcpp::List lss_to_list(const ClinSuffStat& lss);
+Rcpp::List lnsero_to_list(const SeroCount& lnsero);
+SeroCount lnsero_from_list(const Rcpp::List& lnsero);
+arma::mat trial_to_mat(const TrialData& d);
+TrialData trial_from_mat(const arma::mat& m);
+void trial_state_to_mat(const TrialData& d, arma::mat& m);
 
 // end function prototypes
 
 
 
 
-class Trial {
-private:
- int stop_ven_samp = 0;
- int stop_immu_fut = 0;
- int stop_clin_fut = 0;
- int stop_clin_sup = 0;
- int inconclu = 0;
- int nmaxsero = 200;
- int nstartclin = 200;
- int immu_ss = 0;
- int clin_ss = 0;
-
- bool i_final_win = 0;
- bool c_final_win = 0;
+// config
 
-public:
- Trial(Rcpp::List cfg)
- {
-   nmaxsero = cfg["nmaxsero"];
-   nstartclin = cfg["nstartclin"];
+// fetch a required element, naming it in the error if it is absent
+static SEXP cfg_elem(const Rcpp::List& cfg, const char* name){
+ if(!cfg.containsElementNamed(name)){
+   Rcpp::stop(std::string("cfg is missing ") + name);
  }
- Trial(Rcpp::List cfg, int vstop, int ifut, int cfut, int csup, int inc)
- {
-   nmaxsero = cfg["nmaxsero"];
-   nstartclin = cfg["nstartclin"];
-   stop_ven_samp = vstop;
-   stop_immu_fut = ifut;
-   stop_clin_fut = cfut;
-   stop_clin_sup = csup;
-   inconclu = inc;
- }
- int maxsero();
- int startclin_at_n();
- bool do_immu(int n_current);
- bool do_clin(int n_current);
- int is_v_samp_stopped(){return stop_ven_samp;}
- int is_immu_fut(){return stop_immu_fut;}
- int is_clin_fut(){return stop_clin_fut;}
- int is_clin_sup(){return stop_clin_sup;}
- int is_inconclusive(){return inconclu;}
- int getnmaxsero(){return nmaxsero;}
- int getnstartclin(){return nstartclin;}
- int get_immu_ss(){return immu_ss;}
- int get_clin_ss(){return clin_ss;}
- int immu_final(){return i_final_win;}
- int clin_final(){return c_final_win;}
- void immu_stopv();
- void immu_fut();
- void clin_fut();
- void clin_sup();
- void inconclusive();
- void immu_set_ss(int n);
- void clin_set_ss(int n);
- void immu_final_win(bool won);
- void clin_final_win(bool won);
- void immu_state(const int idxsim);
- void clin_state(const int idxsim);
-};
-int Trial::maxsero(){
- return nmaxsero;
+ return cfg[name];
 }
-int Trial::startclin_at_n(){
- return nstartclin;
+
+static double cfg_num(const Rcpp::List& cfg, const char* name){
+ return Rcpp::as<double>(cfg_elem(cfg, name));
 }
-bool Trial::do_immu(int n_current){
- if(stop_ven_samp == 1){
-   return false;
- }
- if(n_current > nmaxsero){
-   return false;
- }
- if(stop_immu_fut == 1){
-   return false;
+
+static int cfg_int(const Rcpp::List& cfg, const char* name){
+ return Rcpp::as<int>(cfg_elem(cfg, name));
+}
+
+// optional elements fall back to the engine default
+static int cfg_int_or(const Rcpp::List& cfg, const char* name, const int dflt){
+ if(!cfg.containsElementNamed(name)){
+   return dflt;
  }
- if(stop_clin_fut == 1){
-   return false;
+ return Rcpp::as<int>(cfg[name]);
+}
+
+static double cfg_num_or(const Rcpp::List& cfg, const char* name, const double dflt){
+ if(!cfg.containsElementNamed(name)){
+   return dflt;
  }
- if(stop_clin_sup == 1){
-   return false;
+ return Rcpp::as<double>(cfg[name]);
+}
+
+// parse and validate the sim_cfg() list once, before any trial runs
+SimConfig read_cfg(const Rcpp::List& cfg){
+
+ SimConfig c;
+
+ c.seed = cfg_seed(cfg);
+
+ c.nstop = cfg_int(cfg, "nstop");
+ c.nmaxsero = cfg_int(cfg, "nmaxsero");
+ c.nstartclin = cfg_int(cfg, "nstartclin");
+ c.looks = Rcpp::as< std::vector<int> >(cfg_elem(cfg, "looks"));
+ c.looks_target = Rcpp::as< std::vector<int> >(cfg_elem(cfg, "looks_target"));
+ c.interimmnths = Rcpp::as< std::vector<double> >(cfg_elem(cfg, "interimmnths"));
+ c.months_per_person = cfg_num(cfg, "months_per_person");
+ c.sero_info_delay = cfg_num(cfg, "sero_info_delay");
+ c.interim_period = cfg_num_or(cfg, "interim_period", 0);
+
+ c.age_months_lwr = cfg_num(cfg, "age_months_lwr");
+ c.age_months_upr = cfg_num(cfg, "age_months_upr");
+ c.max_age_fu_months = cfg_num(cfg, "max_age_fu_months");
+ c.baselineprobsero = cfg_num(cfg, "baselineprobsero");
+ c.trtprobsero = cfg_num(cfg, "trtprobsero");
+ c.deltaserot3 = cfg_num(cfg, "deltaserot3");
+ c.b0tte = cfg_num(cfg, "b0tte");
+ c.b1tte = cfg_num(cfg, "b1tte");
+
+ c.post_draw = cfg_int(cfg, "post_draw");
+ c.prior_gamma_a = cfg_num(cfg, "prior_gamma_a");
+ c.prior_gamma_b = cfg_num(cfg, "prior_gamma_b");
+ c.clin_pp_analytic = cfg_int_or(cfg, "clin_pp_analytic", 1) != 0;
+ c.immu_pp_enumerate = cfg_int_or(cfg, "immu_pp_enumerate", 1) != 0;
+ c.draw_threads = cfg_int_or(cfg, "draw_threads", 1);
+ c.pp_adaptive = cfg_int_or(cfg, "pp_adaptive", 0) != 0;
+ c.pp_batch = cfg_int_or(cfg, "pp_batch", 100);
+ c.pp_adaptive_alpha = cfg_num_or(cfg, "pp_adaptive_alpha", 0.001);
+ c.pp_mc = cfg_int_or(cfg, "pp_mc", PP_MC_PLAIN);
+ c.pp_conditional = cfg_int_or(cfg, "pp_conditional", 0) != 0;
+
+ c.post_final_thresh = cfg_num(cfg, "post_final_thresh");
+ c.pp_sero_fut_thresh = cfg_num(cfg, "pp_sero_fut_thresh");
+ c.pp_sero_sup_thresh = cfg_num(cfg, "pp_sero_sup_thresh");
+ c.pp_tte_fut_thresh = cfg_num(cfg, "pp_tte_fut_thresh");
+ c.post_tte_sup_thresh = Rcpp::as< std::vector<double> >(cfg_elem(cfg, "post_tte_sup_thresh"));
+ c.post_tte_win_thresh = Rcpp::as< std::vector<double> >(cfg_elem(cfg, "post_tte_win_thresh"));
+ c.post_sero_win_thresh = Rcpp::as< std::vector<double> >(cfg_elem(cfg, "post_sero_win_thresh"));
+
+ c.validate();
+
+ return c;
+}
+
+Rcpp::List lss_to_list(const ClinSuffStat& lss){
+ return Rcpp::List::create(Rcpp::Named("n_evnt_0") = lss.n_evnt_0,
+                           Rcpp::Named("tot_obst_0") = lss.tot_obst_0,
+                           Rcpp::Named("n_evnt_1") = lss.n_evnt_1,
+                           Rcpp::Named("tot_obst_1") = lss.tot_obst_1,
+                           Rcpp::Named("fu") = lss.fu);
+}
+
+Rcpp::List lnsero_to_list(const SeroCount& lnsero){
+ return Rcpp::List::create(Rcpp::Named("n_sero_ctl") = lnsero.n_sero_ctl,
+                           Rcpp::Named("n_sero_trt") = lnsero.n_sero_trt);
+}
+
+SeroCount lnsero_from_list(const Rcpp::List& lnsero){
+ SeroCount s;
+ s.n_sero_ctl = (int)lnsero["n_sero_ctl"];
+ s.n_sero_trt = (int)lnsero["n_sero_trt"];
+ return s;
+}
+
+
+// the R view of the trial data, one row per subject in the COL_* layout.
+// only built for the rcpp_ exports and when the caller asks for the data.
+arma::mat trial_to_mat(const TrialData& d){
+ arma::mat m = arma::zeros(d.size(), NCOL);
+ for(int i = 0; i < d.size(); i++){
+   const ArmData& s = d.arm[d.trt[i]];
+   int j = d.pos[i];
+   m(i, COL_ID) = s.id[j];
+   m(i, COL_TRT) = d.trt[i];
+   m(i, COL_ACCRT) = s.accrt[j];
+   m(i, COL_AGE) = s.age[j];
+   m(i, COL_SEROT2) = s.serot2[j];
+   m(i, COL_SEROT3) = s.serot3[j];
+   m(i, COL_PROBT3) = d.trt[i] * d.probt3_trt;
+   m(i, COL_EVTT) = s.evtt[j];
+   m(i, COL_FU1) = d.fu1;
+   m(i, COL_FU2) = d.fu2;
  }
- return true;
+ trial_state_to_mat(d, m);
+ return m;
 }
-bool Trial::do_clin(int n_current){
 
- if(n_current < nstartclin){
-   return false;
+// writes the censoring state columns only
+void trial_state_to_mat(const TrialData& d, arma::mat& m){
+ for(int i = 0; i < d.size(); i++){
+   const ArmData& s = d.arm[d.trt[i]];
+   int j = d.pos[i];
+   m(i, COL_EVTT) = s.evtt[j];
+   m(i, COL_CEN) = s.cen[j] == STATE_NA ? NA_REAL : s.cen[j];
+   m(i, COL_OBST) = s.obst[j];
+   m(i, COL_REASON) = s.reason[j] == STATE_NA ? NA_REAL : s.reason[j];
+   m(i, COL_IMPUTE) = s.impute[j] == STATE_NA ? NA_REAL : s.impute[j];
+   m(i, COL_REFTIME) = s.reftime[j];
  }
- if(stop_clin_fut == 1){
-   return false;
+}
+
+static uint8_t flag_from_double(const double x){
+ return std::isnan(x) ? (uint8_t)STATE_NA : (uint8_t)x;
+}
+
+// for the rcpp_ exports that take the R matrix
+TrialData trial_from_mat(const arma::mat& m){
+ TrialData d;
+ int n = m.n_rows;
+ for(int a = 0; a < 2; a++){
+   d.arm[a].reserve(n/2 + 1);
  }
- if(stop_clin_sup == 1){
-   return false;
+ for(int i = 0; i < n; i++){
+   int a = m(i, COL_TRT) == 0 ? ARM_CTL : ARM_TRT;
+   int j = d.add(a);
+   ArmData& s = d.arm[a];
+   s.id[j] = (int)m(i, COL_ID);
+   s.accrt[j] = m(i, COL_ACCRT);
+   s.age[j] = m(i, COL_AGE);
+   s.serot2[j] = (uint8_t)m(i, COL_SEROT2);
+   s.serot3[j] = (uint8_t)m(i, COL_SEROT3);
+   s.evtt[j] = m(i, COL_EVTT);
+   s.cen[j] = flag_from_double(m(i, COL_CEN));
+   s.obst[j] = m(i, COL_OBST);
+   s.reason[j] = flag_from_double(m(i, COL_REASON));
+   s.impute[j] = flag_from_double(m(i, COL_IMPUTE));
+   s.reftime[j] = m(i, COL_REFTIME);
+   if(a == ARM_TRT) d.probt3_trt = m(i, COL_PROBT3);
  }
- if(stop_immu_fut == 1){
-   return false;
+ if(n > 0){
+   d.fu1 = m(0, COL_FU1);
+   d.fu2 = m(0, COL_FU2);
  }
- return true;
-}
-void Trial::immu_stopv(){stop_ven_samp = 1;}
-void Trial::immu_fut(){
- stop_immu_fut = 1;
- return;
-}
-void Trial::clin_fut(){stop_clin_fut = 1;}
-void Trial::clin_sup(){stop_clin_sup = 1;}
-void Trial::inconclusive(){inconclu = 1;}
-void Trial::immu_set_ss(int n){immu_ss = n;}
-void Trial::clin_set_ss(int n){clin_ss = n;}
-void Trial::immu_final_win(bool won){
- i_final_win = won;
-}
-void Trial::clin_final_win(bool won){
- c_final_win = won;
+ d.n_out = n;
+ d.index_accrual();
+ return d;
 }
-void Trial::immu_state(const int idxsim){
- INFO(Rcpp::Rcout, idxsim,  "immu ep state: intrm stop v samp " << stop_ven_samp <<
-   " fut " << stop_immu_fut << " interm inconclu " << inconclu << " fin analy win " << i_final_win );
+
+
+
+
+// random number streams
+
+// trial streams are keyed by cfg$seed and idxsim so that a trial can be
+// reproduced on its own or as part of a batch on any number of threads.
+// configs without a seed take one from R's RNG.
+uint32_t cfg_seed(const Rcpp::List& cfg){
+ if(cfg.containsElementNamed("seed")){
+   return (uint32_t)(double)cfg["seed"];
+ }
+ return (uint32_t)(R::unif_rand() * 4294967296.0);
 }
-void Trial::clin_state(const int idxsim){
- INFO(Rcpp::Rcout, idxsim, "clin ep state: intrm sup " << stop_clin_sup <<
-   " fut " << stop_clin_fut << " interm inconclu " << inconclu << " fin analy win " << c_final_win );
+
+// for the helpers called directly from R, where there is no idxsim, key
+// the stream off R's RNG so that set.seed() still applies.
+Rng rng_from_r(){
+ uint32_t seed = (uint32_t)(R::unif_rand() * 4294967296.0);
+ uint32_t idx = (uint32_t)(R::unif_rand() * 4294967296.0);
+ return Rng(seed, idx);
 }
 
 
@@ -258,465 +398,609 @@ void Trial::clin_state(const int idxsim){
 Rcpp::List rcpp_dotrial(const int idxsim,
                        const Rcpp::List& cfg,
                        const bool rtn_trial_dat){
+ LogPumpOnExit pump;
+
+ SimConfig c = read_cfg(cfg);
+ Workspace ws;
+ TrialResult r = sim_dotrial(idxsim, c, ws);
+
+ Rcpp::List ret = Rcpp::List::create(Rcpp::Named("idxsim") = r.idxsim);
+ ret["p0"] = r.p0;
+ ret["p1"] = r.p1;
+ ret["m0"] = r.m0;
+ ret["m1"] = r.m1;
+ ret["look"] = r.look;
+ ret["ss_immu"] = r.ss_immu;
+ ret["ss_clin"] = r.ss_clin;
+ ret["stop_v_samp"] = r.stop_v_samp;
+ ret["stop_i_fut"] = r.stop_i_fut;
+ ret["stop_c_fut"] = r.stop_c_fut;
+ ret["stop_c_sup"] = r.stop_c_sup;
+ ret["inconclu"] = r.inconclu;
+ ret["i_final"] = r.i_final;
+ ret["c_final"] = r.c_final;
+ ret["i_ppn"] = r.i_ppn;
+ ret["i_ppmax"] = r.i_ppmax;
+ ret["c_ppn"] = r.c_ppn;
+ ret["c_ppmax"] = r.c_ppmax;
+ ret["i_mean"] = r.i_mean;
+ ret["i_lwr"] = r.i_lwr;
+ ret["i_upr"] = r.i_upr;
+ ret["c_mean"] = r.c_mean;
+ ret["c_lwr"] = r.c_lwr;
+ ret["c_upr"] = r.c_upr;
+
+ if(rtn_trial_dat){
+   // outcomes of those the trial stopped before are drawn now, the same
+   // as they would have been had it run on
+   sim_dat_outcomes(c, Rng(c.seed, idxsim), ws.d.size(), ws.d);
+   ret["d"] = trial_to_mat(ws.d);
+ }
 
-  INFO(Rcpp::Rcout, idxsim, "STARTED.");
-
-  Rcpp::NumericVector looks = cfg["looks"];
-  Rcpp::NumericVector months = cfg["interimmnths"];
-  Rcpp::NumericVector post_tte_sup_thresh = cfg["post_tte_sup_thresh"];
-
-  // used in assessing futility along with pp_tte_fut_thresh
-  Rcpp::NumericVector post_tte_win_thresh = cfg["post_tte_win_thresh"];
-  Rcpp::NumericVector post_sero_win_thresh = cfg["post_sero_win_thresh"];
-  Rcpp::List m_immu_res;
-  Rcpp::List m_clin_res;
-  double current_sup;
-
-  arma::mat d = rcpp_dat(cfg);
-  int nobs = 0;
-
-  //Trial t(cfg, vstop, ifut, cfut, csup, inc);
-  Trial t(cfg);
-  int look;
-  int immulook = 0;
-  int i = 0;
-  for(i = 0; i < looks.length(); i++){
-    // look is here because all the original methods were called from R with r indexing
-    look = i + 1;
-
-    // we may not have started analysing the clin ep yet, but
-    // we still need to set ss here otherwise it would just be recorded as 0 and
-    // we would therefore underestimate the avg
-    t.clin_set_ss(looks[i]);
-
-    if(t.do_immu(looks[i])){
-      immulook = look;
-      nobs = rcpp_n_obs(d, look, looks, months, (double)cfg["sero_info_delay"]);
-      INFO(Rcpp::Rcout, idxsim, "doing immu, with " << looks[i]
-                                                   << " enrld and " << nobs << " test results."
-                                                   << " sup thresh (stop v samp) " << (double)cfg["pp_sero_sup_thresh"]
-                                                   << ", pp win thresh " << (double)post_sero_win_thresh[i]
-                                                   << ", fut thresh " << (double)cfg["pp_sero_fut_thresh"]);
-
-      m_immu_res = rcpp_immu(d, cfg, look);
-
-      if((double)m_immu_res["ppos_max"] < (double)cfg["pp_sero_fut_thresh"]){
-
-        INFO(Rcpp::Rcout, idxsim, "immu futile - stopping now, n_sero_ctl "
-               << (int)m_immu_res["n_sero_ctl"] << " n_sero_ctl " << (int)m_immu_res["n_sero_trt"]
-               << " nobs "<< nobs << " test results " << " ppos_max " << (double)m_immu_res["ppos_max"]);
-        t.immu_fut();
-        t.immu_set_ss(nobs);
-        break;
-      }
-
-      if ((double)m_immu_res["ppos_n"] > (double)cfg["pp_sero_sup_thresh"] && !t.is_immu_fut()){
-        nobs = rcpp_n_obs(d, look, looks, months, (double)cfg["sero_info_delay"]);
-        INFO(Rcpp::Rcout, idxsim, "immu sup - stopping v samp now, n_sero_ctl "
-               << (int)m_immu_res["n_sero_ctl"] << " n_sero_ctl " << (int)m_immu_res["n_sero_trt"]
-               << " nobs "<< nobs << " test results " << " ppos_n " << (double)m_immu_res["ppos_n"] );
-        t.immu_stopv();
-      }
-      t.immu_set_ss(nobs);
-    }
-
-
-    if(t.do_clin(looks[i])){
-      INFO(Rcpp::Rcout, idxsim, "doing clin with " << looks[i]
-                                              << " enrld and sup thresh " << (double)post_tte_sup_thresh[i]
-                                              << ", pp win thresh " << (double)post_tte_win_thresh[i]
-                                              << ", fut thresh " << (double)cfg["pp_tte_fut_thresh"]);
-
-      m_clin_res = rcpp_clin(d, cfg, look, idxsim);
-
-      // INFO(Rcpp::Rcout, idxsim, "blah " << (double)m_clin_res["ratio"] << " "
-      // << (double)m_clin_res["lwr"] << " "
-      // << (double)m_clin_res["upr"] );
-
-      if((double)m_clin_res["ppmax_win"] < (double)cfg["pp_tte_fut_thresh"]){
-        INFO(Rcpp::Rcout, idxsim, "clin futile - stopping now, ppmax " << (double)m_clin_res["ppmax_win"]
-               << " fut thresh " << (double)cfg["pp_tte_fut_thresh"]);
-        t.clin_fut();
-        break;
-      }
-
-      if ((double)m_clin_res["ppn_win"] > (double)post_tte_sup_thresh[i]  && !t.is_clin_fut()){
-        INFO(Rcpp::Rcout, idxsim, "clin sup - stopping now, ppn " << (double)m_clin_res["ppn_win"]
-               << " sup thresh " << (double)post_tte_sup_thresh[i] );
-        t.clin_sup();
-        break;
-      }
-    }
-
-
-    // if at last look set inconclusive
-    if(i == looks.length()-1){
-      t.inconclusive();
-    }
-
-
-  }
-
-
-
-  // final analysis for sero
-  //how many successes in each arm?
-  //if(looks[immulook] > (int)cfg["nmaxsero"]) immulook = immulook - 1;
-  nobs = rcpp_n_obs(d, immulook , looks, months, 0);
-  Rcpp::List lnsero = rcpp_lnsero(d, nobs);
-
-  int nsero0 = (int)lnsero["n_sero_ctl"];
-  int nsero1 = (int)lnsero["n_sero_trt"];
-
-  // posterior at this interim
-  arma::mat m = arma::zeros((int)cfg["post_draw"] , 3);
-  rcpp_immu_interim_post(d, m, (int)cfg["nmaxsero"], (int)cfg["post_draw"], lnsero);
-  arma::uvec tmp = arma::find(m.col(COL_DELTA) > 0);
-  double post_prob_gt0 =  (double)tmp.n_elem / (double)cfg["post_draw"];
-  double i_mym = arma::mean(m.col(COL_DELTA));
-  double i_mysd = arma::stddev(m.col(COL_DELTA));
-  double i_lwr = i_mym - 1.96 * i_mysd;
-  double i_upr = i_mym + 1.96 * i_mysd;
-  i_mym = round(i_mym * 1000) / 1000;
-  i_lwr = round(i_lwr * 1000) / 1000;
-  i_upr = round(i_upr * 1000) / 1000;
-  INFO(Rcpp::Rcout, idxsim, "FINAL: immu postr: n_sero_ctl "
-         << nsero0 << " n_sero_trt " << nsero1 << " nobs " << nobs
-         << " p0 " << arma::mean(m.col(COL_THETA0)) << "  p1 " << arma::mean(m.col(COL_THETA1))
-         << "  delta " << i_mym << " (" << i_lwr << ", " << i_upr
-                                                    << "). n delta gt0 "
-          << tmp.n_elem  <<  " prob_gt0 " << post_prob_gt0);
-
-  if(post_prob_gt0 > (double)cfg["post_final_thresh"]){
-   t.immu_final_win(true);
-  } else{
-   t.immu_final_win(false);
-  }
-  t.immu_state(idxsim);
-
+ return ret;
+}
 
 
+// runs trials 1..nsims in this process and returns one row per trial
+// (same fields as rcpp_dotrial) as a data.frame. each trial writes to its
+// own slot so the table is in idxsim order whatever the schedule and row
+// i matches rcpp_dotrial(i, cfg, FALSE).
+// [[Rcpp::export]]
+Rcpp::List rcpp_dotrial_batch(const int nsims,
+                             const Rcpp::List& cfg,
+                             const int nthreads){
+ LogPumpOnExit pump;
 
+ if(nsims < 1){
+   Rcpp::stop("nsims must be at least 1");
+ }
 
+ SimConfig c = read_cfg(cfg);
+ std::vector<int> idx(nsims);
+ for(int i = 0; i < nsims; i++){
+   idx[i] = i + 1;
+ }
+ std::vector<TrialResult> res;
+ sim_trials(trial_tasks(c, idx), res, nthreads);
 
- // final analysis for tte
- d.col(COL_CEN) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- d.col(COL_OBST) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
-
- if(look > looks.length()) look = looks.size();
-
- // updates d(COL_CEN) and d(COL_OBST)
- Rcpp::List lss = rcpp_clin_set_state(d, look, 36, cfg, idxsim);
+ return table_to_df(result_table(res));
+}
 
- double n_evnt_0b = (double)lss["n_evnt_0"];
- double n_evnt_1b = (double)lss["n_evnt_1"];
- double tot_obst_0 = (double)lss["tot_obst_0"];
- double tot_obst_1 = (double)lss["tot_obst_1"];
 
- double a = (double)cfg["prior_gamma_a"];
- double b = (double)cfg["prior_gamma_b"];
+// as rcpp_dotrial_batch but the rows go to the results file at path (see
+// resfile.h) flush_every trials at a time instead of being returned. if
+// the file exists the trials already in it are skipped so a killed run
+// can be restarted with the same arguments. returns the number of trials
+// run by this call, read the results with rcpp_read_results.
+// [[Rcpp::export]]
+int rcpp_dotrial_batch_file(const int nsims,
+                            const Rcpp::List& cfg,
+                            const int nthreads,
+                            const std::string& path,
+                            const int flush_every){
+ LogPumpOnExit pump;
+
+ if(nsims < 1){
+   Rcpp::stop("nsims must be at least 1");
+ }
+ if(flush_every < 1){
+   Rcpp::stop("flush_every must be at least 1");
+ }
 
- m = arma::zeros((int)cfg["post_draw"] , 3);
+ SimConfig c = read_cfg(cfg);
+ int nrun = 0;
 
- for(int j = 0; j < (int)cfg["post_draw"]; j++){
-   // compute the posterior based on the __observed__ data to the time of the interim
-   // take single draw
-   m(j, COL_LAMB0) = R::rgamma(a + n_evnt_0b, 1/(b + tot_obst_0));
-   m(j, COL_LAMB1) = R::rgamma(a + n_evnt_1b, 1/(b + tot_obst_1));
-   m(j, COL_RATIO) = m(j, COL_LAMB0) / m(j, COL_LAMB1);
+ try {
+   nrun = sim_batch_file(c, nsims, nthreads, path, flush_every);
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
  }
 
- tmp = arma::find(m.col(COL_RATIO) > 1);
- double post_prob_gt1 =  (double)tmp.n_elem / (double)cfg["post_draw"];
-
- double c_mym = arma::mean(m.col(COL_RATIO));
- double c_mysd = arma::stddev(m.col(COL_RATIO));
- double c_lwr = c_mym - 1.96 * c_mysd;
- double c_upr = c_mym + 1.96 * c_mysd;
- c_mym = round(c_mym * 1000) / 1000;
- c_lwr = round(c_lwr * 1000) / 1000;
- c_upr = round(c_upr * 1000) / 1000;
-
- INFO(Rcpp::Rcout, idxsim, "FINAL: clin n = " << looks[look-1] <<
-   " nevnts_0 " << n_evnt_0b << " nevnt_1 " << n_evnt_1b
-                << " postr: l0 "  << arma::mean(m.col(COL_LAMB0))
-                << "  l1 " << arma::mean(m.col(COL_LAMB1))
-                << "  ratio " << c_mym << " (" << c_lwr << ", " << c_upr
-                << "). n ratio gt1 " << tmp.n_elem  <<  "  prob_gt1 " << post_prob_gt1);
-
-   if(post_prob_gt1 > (double)cfg["post_final_thresh"]){
-     t.clin_final_win(true);
-   } else{
-     t.clin_final_win(false);
-   }
-   t.clin_state(idxsim);
-
-
-   Rcpp::List ret = Rcpp::List::create(Rcpp::Named("idxsim") = idxsim);
-   ret["p0"] = (double)cfg["baselineprobsero"];
-   ret["p1"] = (double)cfg["trtprobsero"];
-   ret["m0"] = log(2)/(double)cfg["b0tte"];
-   ret["m1"] = log(2)/((double)cfg["b0tte"] + (double)cfg["b1tte"]);
-   ret["look"] = i < looks.length() ? looks[i] : max(looks);
-   ret["ss_immu"] = t.get_immu_ss();
-   ret["ss_clin"] = t.get_clin_ss();
-   ret["stop_v_samp"] = t.is_v_samp_stopped();
-   ret["stop_i_fut"] = t.is_immu_fut();
-   ret["stop_c_fut"] = t.is_clin_fut();
-   ret["stop_c_sup"] = t.is_clin_sup();
-   ret["inconclu"] = t.is_inconclusive();
-   ret["i_final"] = t.immu_final();
-   ret["c_final"] = t.clin_final();
-   ret["i_ppn"] = m_immu_res.length() > 0 ? (double)m_immu_res["ppos_n"] : NA_REAL;
-   ret["i_ppmax"] = m_immu_res.length() > 0 ? (double)m_immu_res["ppos_max"] : NA_REAL;
-   ret["c_ppn"] = m_clin_res.length() > 0 ? (double)m_clin_res["ppn_win"] : NA_REAL;
-   ret["c_ppmax"] = m_clin_res.length() > 0 ? (double)m_clin_res["ppmax_win"] : NA_REAL;
-   ret["i_mean"] = (double)i_mym;
-   ret["i_lwr"] = (double)i_lwr;
-   ret["i_upr"] = (double)i_upr;
-   ret["c_mean"] = (double)c_mym;
-   ret["c_lwr"] = (double)c_lwr;
-   ret["c_upr"] = (double)c_upr;
-
-   INFO(Rcpp::Rcout, idxsim, "FINISHED.");
-
-   if(rtn_trial_dat){
-     ret["d"] = d;
-   }
+ return nrun;
+}
 
-   // Rcpp::List ret = Rcpp::List::create(Rcpp::Named("idxsim") = idxsim);
 
-   return ret;
+// the results file as a data.frame, in the order the trials were written
+// [[Rcpp::export]]
+Rcpp::List rcpp_read_results(const std::string& path){
+ try {
+   return table_to_df(res_read(path));
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
+ }
+ return R_NilValue;
 }
 
 
+// runs every trial of the cartesian product of a base cfg and the scenario
+// grid, a data.frame whose column names are cfg elements (see
+// SimConfig::set_axis) and whose rows are scenarios. all nrow(grid) x nsims
+// trials go to one pool of nthreads workers that take the next trial as
+// they finish, so slow scenarios do not hold up the rest. scenarios share
+// the seed so trial idxsim starts from the same random numbers in each.
+// returns list(oc, trials): oc has a row per scenario with the axes, the
+// true parameters and the mean of each outcome over the nsims trials;
+// trials has the rcpp_dotrial_batch columns plus the scenario number.
+// [[Rcpp::export]]
+Rcpp::List rcpp_dotrial_grid(const int nsims,
+                             const Rcpp::List& cfg,
+                             const Rcpp::List& grid,
+                             const int nthreads){
+
+ LogPumpOnExit pump;
+ if(nsims < 1){
+   Rcpp::stop("nsims must be at least 1");
+ }
 
+ ScenarioGrid g(read_cfg(cfg), grid);
 
+ std::vector<TrialTask> tasks;
+ for(int k = 0; k < g.nscen(); k++){
+   for(int i = 1; i <= nsims; i++){
+     tasks.push_back({&g.scen[k], i});
+   }
+ }
+ std::vector<TrialResult> res;
+ sim_trials(tasks, res, nthreads);
 
+ return g.results(res, nsims);
+}
 
-// data generation
 
+// common random numbers for the decision thresholds. each of the nsims
+// trials is simulated once with every analysis at every look
+// (TrialAnalysis::trace) and the stopping rules are then replayed for each
+// row of thresh, whose columns may be post_final_thresh,
+// pp_sero_fut_thresh, pp_sero_sup_thresh, pp_tte_fut_thresh,
+// post_tte_sup_thresh (all looks) and nstartclin. a row gives the same
+// trials as rcpp_dotrial_batch with those settings. returns as
+// rcpp_dotrial_grid.
+// [[Rcpp::export]]
+Rcpp::List rcpp_dotrial_thresh(const int nsims,
+                               const Rcpp::List& cfg,
+                               const Rcpp::List& thresh,
+                               const int nthreads){
+
+ LogPumpOnExit pump;
+ if(nsims < 1){
+   Rcpp::stop("nsims must be at least 1");
+ }
 
+ SimConfig c = read_cfg(cfg);
+ if(c.pp_adaptive){
+   Rcpp::stop("pp_adaptive ties the draws to the thresholds, turn it off to replay");
+ }
+ ScenarioGrid g(c, thresh);
+ for(const std::string& a : g.axes){
+   if(!replay_axis(a)){
+     Rcpp::stop(a + " changes the analyses so cannot be replayed, use rcpp_dotrial_grid");
+   }
+ }
 
-// [[Rcpp::export]]
-arma::mat rcpp_dat(const Rcpp::List& cfg) {
+ std::vector< std::vector<LookStat> > tr;
+ sim_traces(c, 0, nsims, nthreads, tr);
 
- int n = cfg["nstop"];
- arma::mat d = arma::zeros(n, NCOL);
- double tpp = (double)cfg["months_per_person"];
+ return g.results(replay_traces(g.scen, tr, c.nmaxsero), nsims);
+}
 
- for(int i = 0; i < n; i++){
 
-   d(i, COL_ID) = i+1;
-   d(i, COL_TRT) = ((i-1)%2 == 0) ? 0 : 1;
-   // simultaneous accrual of each next ctl/trt pair
-   d(i, COL_ACCRT) = (i%2 == 0) ? ((i+1)*tpp)+tpp : (i+1)*tpp;
+// writes the traces of trials 1..nsims to path (see tracefile.h), for
+// rcpp_trace_replay and rcpp_read_trace. returns the number of trials.
+// [[Rcpp::export]]
+int rcpp_trace_file(const int nsims,
+                    const Rcpp::List& cfg,
+                    const int nthreads,
+                    const std::string& path){
+ LogPumpOnExit pump;
+
+ if(nsims < 1){
+   Rcpp::stop("nsims must be at least 1");
+ }
+
+ SimConfig c = read_cfg(cfg);
+ if(c.pp_adaptive){
+   Rcpp::stop("pp_adaptive ties the draws to the thresholds, turn it off to replay");
+ }
+ TraceHeader h;
+ h.seed = c.seed;
+ h.cfg = c.result_hash(false);
+ h.nmaxsero = c.nmaxsero;
+ h.looks.assign(c.looks.begin(), c.looks.end());
+
+ // a block of trials is held in memory at a time
+ const int block = 256;
+ try {
+   TraceWriter w(path, h);
+   std::vector< std::vector<LookStat> > tr;
+   for(int k = 0; k < nsims; k += block){
+     sim_traces(c, k, std::min(block, nsims - k), nthreads, tr);
+     for(const std::vector<LookStat>& st : tr){
+       w.add(st);
+     }
+   }
+   w.close();
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
+ }
 
-   // d(i, COL_AGE) = r_truncnorm(cfg["age_months_mean"], cfg["age_months_sd"],
-   //   cfg["age_months_lwr"], cfg["age_months_upr"]);
+ return nsims;
+}
 
-   d(i, COL_AGE) = R::runif((double)cfg["age_months_lwr"], (double)cfg["age_months_upr"]);
 
-   d(i, COL_SEROT2) = R::rbinom(1, cfg["baselineprobsero"]);
-   d(i, COL_SEROT3) = d(i, COL_SEROT2);
-   d(i, COL_PROBT3) = d(i, COL_TRT) * (double)cfg["deltaserot3"];
+// the stopping rules of each row of rules replayed on the traces in path.
+// rules takes the rcpp_dotrial_thresh columns and also nmaxsero, which
+// may not exceed the nmaxsero the traces were made with. for a smaller
+// nmaxsero the immu analyses are redone from the sero counts in the
+// trace (trace_nmaxsero). every row gives the same trials as
+// rcpp_dotrial_batch with those settings. cfg gives the remaining
+// settings and must be those the traces were made with apart from the
+// rules. returns as rcpp_dotrial_grid.
+// [[Rcpp::export]]
+Rcpp::List rcpp_trace_replay(const std::string& path,
+                             const Rcpp::List& cfg,
+                             const Rcpp::List& rules){
+
+ SimConfig c = read_cfg(cfg);
+ TraceHeader h;
+ std::vector<LookStat> st;
+ try {
+   st = trace_read(path, h);
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
+ }
+ if(std::vector<int>(h.looks.begin(), h.looks.end()) != c.looks){
+   Rcpp::stop("cfg looks differ from those of the trace");
+ }
+ if(h.seed != c.seed){
+   Rcpp::stop("cfg seed differs from that of the trace");
+ }
+ if(h.cfg != c.result_hash(false)){
+   Rcpp::stop("cfg differs from that of the trace in more than the rules");
+ }
 
-   if(d(i, COL_SEROT2) == 0 && d(i, COL_TRT) == 1){
-     d(i, COL_SEROT3) = R::rbinom(1, d(i, COL_PROBT3));
+ ScenarioGrid g(c, rules);
+ for(const std::string& a : g.axes){
+   if(!replay_axis(a) && a != "nmaxsero"){
+     Rcpp::stop(a + " changes the analyses so cannot be replayed");
    }
+ }
+ for(const SimConfig& sc : g.scen){
+   if(sc.nmaxsero > h.nmaxsero){
+     Rcpp::stop("nmaxsero exceeds the traced nmaxsero");
+   }
+ }
+
+ int nlooks = c.nlooks();
+ int ntrial = (int)st.size() / nlooks;
+ if(ntrial < 1){
+   Rcpp::stop("trace file has no trials");
+ }
+ std::vector< std::vector<LookStat> > tr(ntrial);
+ for(int i = 0; i < ntrial; i++){
+   tr[i].assign(st.begin() + i * nlooks, st.begin() + (i + 1) * nlooks);
+ }
+
+ return g.results(replay_traces(g.scen, tr, h.nmaxsero), ntrial);
+}
+
 
+// the trace records in path as a data.frame, a row per trial and look
+// [[Rcpp::export]]
+Rcpp::List rcpp_read_trace(const std::string& path){
+
+ TraceHeader h;
+ std::vector<LookStat> st;
+ try {
+   st = trace_read(path, h);
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
+ }
 
-   // tte - the paramaterisation of rexp uses SCALE NOTE RATE!!!!!!!!!!!
-   // event time is the time from randomisation (not birth) at which first
-   // medical presentation occurs
-   if(d(i, COL_TRT) == 0){
-     d(i, COL_EVTT) = R::rexp(1/(double)cfg["b0tte"])  ;
+ static const struct {
+   const char* name;
+   int32_t LookStat::* i;
+   double LookStat::* x;
+ } cols[] = {
+   {"idxsim", &LookStat::idxsim, nullptr}, {"look", &LookStat::look, nullptr},
+   {"immu", &LookStat::immu, nullptr}, {"clin", &LookStat::clin, nullptr},
+   {"i_fin", &LookStat::i_fin, nullptr}, {"c_fin", &LookStat::c_fin, nullptr},
+   {"nobs", &LookStat::nobs, nullptr},
+   {"n_sero_ctl", &LookStat::n_sero_ctl, nullptr},
+   {"n_sero_trt", &LookStat::n_sero_trt, nullptr},
+   {"n_evnt_0", &LookStat::n_evnt_0, nullptr},
+   {"n_evnt_1", &LookStat::n_evnt_1, nullptr},
+   {"i_draws", &LookStat::i_draws, nullptr},
+   {"c_draws", &LookStat::c_draws, nullptr},
+   {"f_nobs", &LookStat::f_nobs, nullptr},
+   {"f_sero_ctl", &LookStat::f_sero_ctl, nullptr},
+   {"f_sero_trt", &LookStat::f_sero_trt, nullptr},
+   {"tot_obst_0", nullptr, &LookStat::tot_obst_0},
+   {"tot_obst_1", nullptr, &LookStat::tot_obst_1},
+   {"i_ppn", nullptr, &LookStat::i_ppn}, {"i_ppmax", nullptr, &LookStat::i_ppmax},
+   {"c_ppn", nullptr, &LookStat::c_ppn}, {"c_ppmax", nullptr, &LookStat::c_ppmax},
+   {"i_post", nullptr, &LookStat::i_post}, {"i_mean", nullptr, &LookStat::i_mean},
+   {"i_lwr", nullptr, &LookStat::i_lwr}, {"i_upr", nullptr, &LookStat::i_upr},
+   {"c_post", nullptr, &LookStat::c_post}, {"c_mean", nullptr, &LookStat::c_mean},
+   {"c_lwr", nullptr, &LookStat::c_lwr}, {"c_upr", nullptr, &LookStat::c_upr}};
+
+ ResTable t;
+ t.nrow = (int)st.size();
+ for(const auto& col : cols){
+   if(col.i){
+     std::vector<int32_t> v(t.nrow);
+     for(int k = 0; k < t.nrow; k++) v[k] = st[k].*col.i;
+     t.cols.push_back(ResColumn{col.name, RES_INT});
+     t.icol.push_back(v);
    } else {
-     double beta = (double)cfg["b0tte"] + (double)cfg["b1tte"];
-     d(i, COL_EVTT) = R::rexp(1/beta)  ;
+     std::vector<double> v(t.nrow);
+     for(int k = 0; k < t.nrow; k++) v[k] = st[k].*col.x;
+     t.cols.push_back(ResColumn{col.name, RES_DBL});
+     t.dcol.push_back(v);
    }
+ }
+ return table_to_df(t);
+}
+
 
-   // fu 1 and 2 times from time of accrual
-   // fu 1 is between 14 and 21 days from accrual
-   // fu 2 is between 28 and 55 days from accrual
-   d(i, COL_FU1) = 0.575; //R::runif((double)cfg["fu1_lwr"], (double)cfg["fu1_upr"]);
-   d(i, COL_FU2) = 1.36345; // R::runif((double)cfg["fu2_lwr"], (double)cfg["fu2_upr"]);
+// event log
 
+// opens the engine's event log (evlog.h) at level, one of "OFF", "FATAL",
+// "WARN", "INFO", "DEBUG" or "TRACE" as for futile.logger. the events
+// are drained by a background thread. with path "" it gathers them in
+// memory and they are printed to the console as each export returns (and
+// between trials), otherwise binary records go to the file at path, read
+// them with rcpp_read_log after rcpp_log_close.
+// INFO gives the stopping decisions, final analyses and the end of each
+// trial, DEBUG adds every interim analysis.
+// [[Rcpp::export]]
+void rcpp_log(const std::string& path, const std::string& level){
+ int l = log_level_from_name(level);
+ if(l < 0){
+   Rcpp::stop("unknown log level " + level);
  }
+ log_stop();
+ r_log_reset();
+ if(l == LOG_OFF) return;
+ try {
+   if(path.empty()){
+     r_log_buf = new LogBufferSink();
+     r_log_sink.reset(r_log_buf);
+   } else {
+     r_log_sink.reset(new LogFileSink(path));
+   }
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
+ }
+ log_start(r_log_sink.get(), l, true);
+}
 
- d.col(COL_CEN) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- d.col(COL_OBST) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- d.col(COL_REASON) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- d.col(COL_IMPUTE) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- d.col(COL_REFTIME) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
 
- return d;
+// writes out what the log holds and closes it
+// [[Rcpp::export]]
+void rcpp_log_close(){
+ log_stop();
+ r_log_reset();
 }
 
 
+// the records of a binary log as a data.frame, a row per event. t is in
+// seconds from rcpp_log, tid the engine thread and x1.. the event's
+// statistics (see log_events in evlog.cpp), 0 past the last.
+// [[Rcpp::export]]
+Rcpp::List rcpp_read_log(const std::string& path){
 
+ std::vector<LogRec> recs;
+ try {
+   recs = log_read(path);
+ } catch(std::runtime_error& e){
+   Rcpp::stop(e.what());
+ }
 
+ int n = (int)recs.size();
+ Rcpp::NumericVector t(n);
+ Rcpp::IntegerVector tid(n);
+ Rcpp::CharacterVector level(n);
+ Rcpp::IntegerVector idxsim(n);
+ Rcpp::IntegerVector look(n);
+ Rcpp::CharacterVector event(n);
+ std::vector< std::vector<double> > x(LOG_NX, std::vector<double>(n));
+ for(int i = 0; i < n; i++){
+   const LogRec& r = recs[i];
+   t[i] = r.t_ns * 1e-9;
+   tid[i] = r.tid;
+   level[i] = log_level_name(r.level);
+   idxsim[i] = r.idxsim;
+   look[i] = r.look;
+   event[i] = log_event_name(r.ev);
+   for(int k = 0; k < LOG_NX; k++) x[k][i] = r.x[k];
+ }
 
-// clinical endpoint
+ return Rcpp::DataFrame::create(Rcpp::Named("t") = t,
+                                Rcpp::Named("tid") = tid,
+                                Rcpp::Named("level") = level,
+                                Rcpp::Named("idxsim") = idxsim,
+                                Rcpp::Named("look") = look,
+                                Rcpp::Named("event") = event,
+                                Rcpp::Named("x1") = Rcpp::NumericVector(x[0].begin(), x[0].end()),
+                                Rcpp::Named("x2") = Rcpp::NumericVector(x[1].begin(), x[1].end()),
+                                Rcpp::Named("x3") = Rcpp::NumericVector(x[2].begin(), x[2].end()),
+                                Rcpp::Named("x4") = Rcpp::NumericVector(x[3].begin(), x[3].end()),
+                                Rcpp::Named("x5") = Rcpp::NumericVector(x[4].begin(), x[4].end()),
+                                Rcpp::Named("stringsAsFactors") = false);
+}
 
 
 
 
+// performance counters
 
+// starts (on TRUE) or stops the engine's performance counters (perfctr.h),
+// returns whether they were on. they are off when the package loads.
 // [[Rcpp::export]]
-Rcpp::List rcpp_clin(arma::mat& d, const Rcpp::List& cfg,
-                    const int look, const int idxsim) {
+bool rcpp_perf_enable(const bool on){
+ return perf_enable(on);
+}
 
- int post_draw = (int)cfg["post_draw"];
- int mylook = look - 1;
- double fudge = 0.0001;
- double fu = (double)cfg["max_age_fu_months"];
 
- double a = (double)cfg["prior_gamma_a"];
- double b = (double)cfg["prior_gamma_b"];
+// the counters as a data.frame with a row per engine thread and phase or
+// counter. kind is "phase" for the timed phases, where n is the number
+// of calls and sec the time spent in them including the phases they
+// call, and "count" for the counters, where sec is NA. thread numbers
+// the threads in the order they first recorded. with reset the counters
+// go back to zero after they are read.
+// [[Rcpp::export]]
+Rcpp::List rcpp_perf_counters(const bool reset){
+
+ std::vector<PerfSlot> slots = perf_read();
+ if(reset) perf_reset();
+
+ int n = (int)slots.size() * (PF_COUNT + PC_COUNT);
+ Rcpp::IntegerVector thread(n);
+ Rcpp::CharacterVector counter(n);
+ Rcpp::CharacterVector kind(n);
+ Rcpp::NumericVector count(n);
+ Rcpp::NumericVector sec(n);
+ int i = 0;
+ for(int k = 0; k < (int)slots.size(); k++){
+   for(int ph = 0; ph < PF_COUNT; ph++, i++){
+     thread[i] = k;
+     counter[i] = perf_phase_name(ph);
+     kind[i] = "phase";
+     count[i] = (double)slots[k].calls[ph];
+     sec[i] = slots[k].ns[ph] * 1e-9;
+   }
+   for(int pc = 0; pc < PC_COUNT; pc++, i++){
+     thread[i] = k;
+     counter[i] = perf_counter_name(pc);
+     kind[i] = "count";
+     count[i] = (double)slots[k].n[pc];
+     sec[i] = na_real();
+   }
+ }
 
- Rcpp::NumericVector looks = cfg["looks"];
- Rcpp::NumericVector months = cfg["interimmnths"];
-
- arma::mat m = arma::zeros(post_draw , 3);
- arma::mat m_pp_int = arma::zeros(post_draw , 3);
- arma::mat m_pp_max = arma::zeros(post_draw , 3);
-
- arma::uvec uimpute;
- arma::uvec ugt1;
- arma::vec ppos_int_ratio_gt1 = arma::zeros(post_draw);
- arma::vec ppos_max_ratio_gt1 = arma::zeros(post_draw);
-
- // compute suff stats (calls visits and censoring) for the current interim
- d.col(COL_CEN) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- d.col(COL_OBST) = arma::vec(Rcpp::rep(NA_REAL, (int)cfg["nstop"]));
- Rcpp::List lss_post = rcpp_clin_set_state(d, look, 0, cfg, idxsim);
- int n_evnt_0 = (double)lss_post["n_evnt_0"];
- int n_evnt_1 = (double)lss_post["n_evnt_1"];
- double tot_obst_0 = (double)lss_post["tot_obst_0"];
- double tot_obst_1 = (double)lss_post["tot_obst_1"];
-
- // keep a copy of the original state
- arma::mat d_orig = arma::zeros((int)cfg["nstop"], 6);
- d_orig.col(0) = arma::vec(d.col(COL_EVTT));
- d_orig.col(1) = arma::vec(d.col(COL_CEN));
- d_orig.col(2) = arma::vec(d.col(COL_OBST));
- d_orig.col(3) = arma::vec(d.col(COL_REASON));
- d_orig.col(4) = arma::vec(d.col(COL_IMPUTE));
- d_orig.col(5) = arma::vec(d.col(COL_REFTIME));
-
- // subjs that require imputation
- uimpute = arma::find(d.col(COL_IMPUTE) == 1);
-
- // containers for next imputed data sufficient stats
- Rcpp::List lss_int;
- Rcpp::List lss_max;
-
- int int_win = 0;
- int max_win = 0;
-
- double p_int_win = 0;
- double p_max_win = 0;
-
- // for i in postdraws do posterior predictive trials
- // 1. for the interim (if we are at less than 50 per qtr)
- // 2. for the max sample size
- for(int i = 0; i < post_draw; i++){
+ return Rcpp::DataFrame::create(Rcpp::Named("thread") = thread,
+                                Rcpp::Named("counter") = counter,
+                                Rcpp::Named("kind") = kind,
+                                Rcpp::Named("n") = count,
+                                Rcpp::Named("sec") = sec,
+                                Rcpp::Named("stringsAsFactors") = false);
+}
 
-   // compute the posterior based on the __observed__ data to the time of the interim
-   // take single draw
-   m(i, COL_LAMB0) = R::rgamma(a + n_evnt_0, 1/(b + tot_obst_0));
-   m(i, COL_LAMB1) = R::rgamma(a + n_evnt_1, 1/(b + tot_obst_1));
-   m(i, COL_RATIO) = m(i, COL_LAMB0) / m(i, COL_LAMB1);
-
-   // use memoryless prop of exponential and impute enrolled kids that have not
-   // yet had event.
-   for(int j = 0; j < (int)uimpute.n_elem; j++){
-     int sub_idx = uimpute(j);
-     if(d(sub_idx, COL_TRT) == 0){
-       // this assigns a new evtt time on which we will update state.
-       d(sub_idx, COL_EVTT) = d(sub_idx, COL_OBST) + R::rexp(1/m(i, COL_LAMB0))  ;
-     } else {
-       d(sub_idx, COL_EVTT) = d(sub_idx, COL_OBST) + R::rexp(1/m(i, COL_LAMB1))  ;
-     }
-   }
 
-   // update view of the sufficent stats using enrolled
-   // kids that have all now been given an event time
-   lss_int = rcpp_clin_set_state(d, look, fu, cfg, idxsim);
-   for(int j = 0; j < post_draw; j++){
-     m_pp_int(j, COL_LAMB0) = R::rgamma(a + (double)lss_int["n_evnt_0"], 1/(b + (double)lss_int["tot_obst_0"]));
-     m_pp_int(j, COL_LAMB1) = R::rgamma(a + (double)lss_int["n_evnt_1"], 1/(b + (double)lss_int["tot_obst_1"]));
-     m_pp_int(j, COL_RATIO) = m_pp_int(j, COL_LAMB0) / m_pp_int(j, COL_LAMB1);
-   }
-   // empirical posterior probability that ratio_lamb > 1
-   ugt1 = arma::find(m_pp_int.col(COL_RATIO) > 1);
-   ppos_int_ratio_gt1(i) =  (double)ugt1.n_elem / (double)post_draw;
-   //INFO(Rcpp::Rcout, idxsim, "ugt1.n_elem = " << ugt1.n_elem << " ppos_int_ratio_gt1(" << i << ") = " << ppos_int_ratio_gt1(i));
-   if(ppos_int_ratio_gt1(i) > 0.96){
-     int_win++;
-   }
+// settings that only enter the stopping rules
+bool replay_axis(const std::string& name){
+ static const char* names[] = {
+   "post_final_thresh", "pp_sero_fut_thresh", "pp_sero_sup_thresh",
+   "pp_tte_fut_thresh", "post_tte_sup_thresh", "nstartclin"};
+ for(const char* nm : names){
+   if(name == nm) return true;
+ }
+ return false;
+}
 
-   // impute the remaining kids
-   for(int k = looks[mylook]; k < max(looks); k++){
-     if(d(k, COL_TRT) == 0){
-       d(k, COL_EVTT) = R::rexp(1/m(i, COL_LAMB0))  ;
-     } else {
-       d(k, COL_EVTT) = R::rexp(1/m(i, COL_LAMB1))  ;
-     }
-   }
 
-   // set the state up to the max sample size at time of the final analysis
-   lss_max = rcpp_clin_set_state(d, looks.length(), fu, cfg, idxsim);
-   // what does the posterior at max sample size say?
-   for(int j = 0; j < post_draw; j++){
-     m_pp_max(j, COL_LAMB0) = R::rgamma(a + (double)lss_max["n_evnt_0"], 1/(b + (double)lss_max["tot_obst_0"]));
-     m_pp_max(j, COL_LAMB1) = R::rgamma(a + (double)lss_max["n_evnt_1"], 1/(b + (double)lss_max["tot_obst_1"]));
-     m_pp_max(j, COL_RATIO) = m_pp_max(j, COL_LAMB0) / m_pp_max(j, COL_LAMB1);
+ScenarioGrid::ScenarioGrid(const SimConfig& base, const Rcpp::List& grid){
+
+ if(grid.size() < 1){
+   Rcpp::stop("grid has no axes");
+ }
+ axes = Rcpp::as< std::vector<std::string> >(grid.names());
+ for(int j = 0; j < (int)axes.size(); j++){
+   vals.push_back(Rcpp::as< std::vector<double> >(grid[j]));
+   if(vals[j].size() != vals[0].size()){
+     Rcpp::stop("grid columns must have the same length");
    }
-   // empirical posterior probability that ratio_lamb > 1
-   ugt1 = arma::find(m_pp_max.col(COL_RATIO) > 1);
-   ppos_max_ratio_gt1(i) =  (double)ugt1.n_elem / (double)post_draw;
-   //INFO(Rcpp::Rcout, idxsim, "ugt1.n_elem = " << ugt1.n_elem << " ppos_max_ratio_gt1(" << i << ") = " << ppos_max_ratio_gt1(i));
-   if(ppos_max_ratio_gt1(i) > 0.96){
-     max_win++;
+ }
+ if(vals[0].empty()){
+   Rcpp::stop("grid has no scenarios");
+ }
+
+ scen.assign(vals[0].size(), base);
+ for(int k = 0; k < nscen(); k++){
+   for(int j = 0; j < (int)axes.size(); j++){
+     scen[k].set_axis(axes[j], vals[j][k]);
    }
+   scen[k].validate();
+ }
+}
 
-   // reset to original state ready for the next posterior draw
-   d.col(COL_EVTT) = arma::vec(d_orig.col(0));
-   d.col(COL_CEN) = arma::vec(d_orig.col(1));
-   d.col(COL_OBST) = arma::vec(d_orig.col(2));
-   d.col(COL_REASON) = arma::vec(d_orig.col(3));
-   d.col(COL_IMPUTE) = arma::vec(d_orig.col(4));
-   d.col(COL_REFTIME) = arma::vec(d_orig.col(5));
 
- }
+// res holds the nsims trials of each scenario in turn
+Rcpp::List ScenarioGrid::results(const std::vector<TrialResult>& res,
+                                 const int nsims) const {
 
- double ppn = arma::mean(ppos_int_ratio_gt1);
- double ppmax = arma::mean(ppos_max_ratio_gt1);
+ int n = nscen();
 
- double ppn_win = (double)int_win/(double)post_draw;
- double ppmax_win = (double)max_win/(double)post_draw;
+ // per trial
+ ResTable tt = result_table(res);
+ std::vector<int32_t> scen_col(res.size());
+ for(int k = 0; k < (int)res.size(); k++){
+   scen_col[k] = k / nsims + 1;
+ }
+ tt.cols.insert(tt.cols.begin(), ResColumn{"scenario", RES_INT});
+ tt.icol.insert(tt.icol.begin(), scen_col);
+
+ // per scenario
+ static const char* oc_names[] = {
+   "p0", "p1", "m0", "m1", "look", "ss_immu", "ss_clin",
+   "stop_v_samp", "stop_i_fut", "stop_c_fut", "stop_c_sup", "inconclu",
+   "i_final", "c_final"};
+ ResTable oc;
+ oc.nrow = n;
+ oc.cols.push_back(ResColumn{"scenario", RES_INT});
+ oc.icol.push_back(std::vector<int32_t>(n));
+ for(int j = 0; j < (int)axes.size(); j++){
+   oc.cols.push_back(ResColumn{axes[j], RES_DBL});
+   oc.dcol.push_back(vals[j]);
+ }
+ oc.cols.push_back(ResColumn{"nsims", RES_INT});
+ oc.icol.push_back(std::vector<int32_t>(n, nsims));
+ for(const char* nm : oc_names){
+   const ResultCol* rc = nullptr;
+   for(int j = 0; j < n_result_cols; j++){
+     if(std::strcmp(result_cols[j].name, nm) == 0) rc = &result_cols[j];
+   }
+   std::vector<double> m(n, 0.0);
+   for(int k = 0; k < n; k++){
+     double tot = 0;
+     for(int i = 0; i < nsims; i++){
+       const TrialResult& r = res[k * nsims + i];
+       tot += rc->i ? (double)(r.*rc->i) : r.*rc->x;
+     }
+     m[k] = tot / nsims;
+   }
+   oc.cols.push_back(ResColumn{nm, RES_DBL});
+   oc.dcol.push_back(m);
+ }
+ for(int k = 0; k < n; k++){
+   oc.icol[0][k] = k + 1;
+ }
 
- INFO(Rcpp::Rcout, idxsim, "clin: n " << looks[mylook]
-                                      << " nevnt_0 " << n_evnt_0 << " nevnt_1 " << n_evnt_1
-                                      << " tot_obst_0 " << tot_obst_0 << " tot_obst_1 " << tot_obst_1);
+ return Rcpp::List::create(Rcpp::Named("oc") = table_to_df(oc),
+                           Rcpp::Named("trials") = table_to_df(tt));
+}
 
- INFO(Rcpp::Rcout, idxsim, "clin: ppn_win " << ppn_win << " ppmax_win " << ppmax_win);
 
- Rcpp::List ret = Rcpp::List::create(Rcpp::Named("ppn") = ppn,
-                                     Rcpp::Named("ppmax") = ppmax,
-                                     Rcpp::Named("ppn_win") = ppn_win,
-                                     Rcpp::Named("ppmax_win") = ppmax_win,
-                                     Rcpp::Named("lss_post") = lss_post,
-                                     Rcpp::Named("lss_int") = lss_int,
-                                     Rcpp::Named("lss_max") = lss_max,
-                                     Rcpp::Named("uimpute") = uimpute,
-                                     Rcpp::Named("m") = m,
-                                     Rcpp::Named("ppos_int_ratio_gt1") = ppos_int_ratio_gt1,
-                                     Rcpp::Named("ppos_max_ratio_gt1") = ppos_max_ratio_gt1);
+Rcpp::List table_to_df(const ResTable& t){
 
- // Rcpp::List ret = Rcpp::List::create(Rcpp::Named("ppmax") = 0);
+ // more columns than DataFrame::create takes so build the list by hand
+ Rcpp::List ret(t.cols.size());
+ Rcpp::CharacterVector nm(t.cols.size());
+ int ki = 0;
+ int kd = 0;
+ for(int j = 0; j < (int)t.cols.size(); j++){
+   nm[j] = t.cols[j].name;
+   if(t.cols[j].type == RES_INT){
+     ret[j] = Rcpp::IntegerVector(t.icol[ki].begin(), t.icol[ki].end());
+     ki++;
+   } else {
+     ret[j] = Rcpp::NumericVector(t.dcol[kd].begin(), t.dcol[kd].end());
+     kd++;
+   }
+ }
+ ret.attr("names") = nm;
+ ret.attr("row.names") = Rcpp::IntegerVector::create(NA_INTEGER, -t.nrow);
+ ret.attr("class") = "data.frame";
 
  return ret;
 }
@@ -726,106 +1010,51 @@ Rcpp::List rcpp_clin(arma::mat& d, const Rcpp::List& cfg,
 
 
 
+// data generation
 
-// [[Rcpp::export]]
-Rcpp::List rcpp_clin_set_state(arma::mat& d, const int look,
-                              const double fu,
-                              const Rcpp::List& cfg, const int idxsim){
-
- // this updates the state of d in place
- // and provides sufficient stats.
 
- int mylook = look - 1;
- double fudge = 0.0001;
 
- int n_evnt_0 = 0;
- int n_evnt_1 = 0;
- double tot_obst_0 = 0;
- double tot_obst_1 = 0;
+// [[Rcpp::export]]
+arma::mat rcpp_dat(const Rcpp::List& cfg) {
+ return trial_to_mat(sim_dat(read_cfg(cfg), rng_from_r()));
+}
 
- double a = (double)cfg["prior_gamma_a"];
- double b = (double)cfg["prior_gamma_b"];
 
- Rcpp::NumericVector looks = cfg["looks"];
- Rcpp::NumericVector months = cfg["interimmnths"];
- Rcpp::List lsuffstat;
 
- arma::uvec utmp;
 
- // set censoring and event times up to current enrolled
- // these kids were all enrolled prior to the current look
- for(int sub_idx = 0; sub_idx < looks[mylook]; sub_idx++){
 
-   if(fu == 0){
-     d(sub_idx, COL_REFTIME) = months[mylook];
-   } else {
+// clinical endpoint
 
-     if(fu - d(sub_idx, COL_AGE) + d(sub_idx, COL_ACCRT) > months[mylook]){
-       d(sub_idx, COL_REFTIME) = fu - d(sub_idx, COL_AGE) + d(sub_idx, COL_ACCRT);
-     } else {
-       d(sub_idx, COL_REFTIME) = months[mylook];
-     }
 
-   }
-   DBG(Rcpp::Rcout, "d(sub_idx, COL_REFTIME) " << d(sub_idx, COL_REFTIME) );
-
-   if(d(sub_idx, COL_ACCRT) + d(sub_idx, COL_EVTT) <= d(sub_idx, COL_REFTIME) &&
-      d(sub_idx, COL_AGE) + d(sub_idx, COL_EVTT) <= (double)cfg["max_age_fu_months"]){
-     // observed event
-     // dont impute
-     d(sub_idx, COL_CEN) = 0;
-     d(sub_idx, COL_OBST) = d(sub_idx, COL_EVTT);
-     d(sub_idx, COL_REASON) = 1;
-     d(sub_idx, COL_IMPUTE) = 0;
-
-     if(d(sub_idx, COL_TRT) == 0) {
-       n_evnt_0 += 1;
-     } else {
-       n_evnt_1 += 1;
-     }
 
-   } else if (d(sub_idx, COL_ACCRT) + d(sub_idx, COL_EVTT) <= d(sub_idx, COL_REFTIME) &&
-     d(sub_idx, COL_AGE) + d(sub_idx, COL_EVTT) > (double)cfg["max_age_fu_months"]){
-     // censor at max age
-     // dont impute
-     d(sub_idx, COL_CEN) = 1;
-     d(sub_idx, COL_OBST) = (double)cfg["max_age_fu_months"] - d(sub_idx, COL_AGE);
-     d(sub_idx, COL_REASON) = 2;
-     d(sub_idx, COL_IMPUTE) = 0;
-
-   } else if (d(sub_idx, COL_ACCRT) + d(sub_idx, COL_EVTT) > d(sub_idx, COL_REFTIME) &&
-     d(sub_idx, COL_REFTIME) - d(sub_idx, COL_ACCRT) <=
-     (double)cfg["max_age_fu_months"] - d(sub_idx, COL_AGE)){
-     // censor at mnth - accrual (t2)
-     // impute
-     d(sub_idx, COL_CEN) = 1;
-     d(sub_idx, COL_OBST) = d(sub_idx, COL_REFTIME) - d(sub_idx, COL_ACCRT) ;
-     d(sub_idx, COL_REASON) = 3;
-     d(sub_idx, COL_IMPUTE) = 1;
-
-   } else { // mnth - accrual >= max age - age at accrual
-     // censor at max age
-     // dont impute
-     d(sub_idx, COL_CEN) = 1;
-     d(sub_idx, COL_OBST) = (double)cfg["max_age_fu_months"] - d(sub_idx, COL_AGE) ;
-     d(sub_idx, COL_REASON) = 4;
-     d(sub_idx, COL_IMPUTE) = 0;
 
-   }
-
-   if(d(sub_idx, COL_TRT) == 0) {
-     tot_obst_0 = tot_obst_0 + d(sub_idx, COL_OBST);
-   } else {
-     tot_obst_1 = tot_obst_1 + d(sub_idx, COL_OBST);
-   }
- }
 
+// [[Rcpp::export]]
+Rcpp::List rcpp_clin(arma::mat& d, const Rcpp::List& cfg,
+                    const int look, const int idxsim) {
 
- Rcpp::List ret = Rcpp::List::create(Rcpp::Named("n_evnt_0") = n_evnt_0,
-                                     Rcpp::Named("tot_obst_0") = tot_obst_0,
-                                     Rcpp::Named("n_evnt_1") = n_evnt_1,
-                                     Rcpp::Named("tot_obst_1") = tot_obst_1,
-                                     Rcpp::Named("fu") = fu);
+ SimConfig c = read_cfg(cfg);
+ Rng rng(c.seed, idxsim);
+ TrialData td = trial_from_mat(d);
+ Workspace ws;
+ ws.fit(c);
+ ClinTally tally;
+ const ClinRes& r = sim_clin(td, c, look, idxsim, rng, tally, ws);
+ trial_state_to_mat(td, d);
+
+ int n = r.n_draw;
+ Rcpp::List ret = Rcpp::List::create(Rcpp::Named("ppn") = r.ppn,
+                                     Rcpp::Named("ppmax") = r.ppmax,
+                                     Rcpp::Named("ppn_win") = r.ppn_win,
+                                     Rcpp::Named("ppmax_win") = r.ppmax_win,
+                                     Rcpp::Named("lss_post") = lss_to_list(r.lss_post),
+                                     Rcpp::Named("lss_int") = lss_to_list(r.lss_int),
+                                     Rcpp::Named("lss_max") = lss_to_list(r.lss_max),
+                                     Rcpp::Named("uimpute") = arma::conv_to<arma::uvec>::from(ws.ci.uimpute),
+                                     Rcpp::Named("m") = arma::mat(r.m.head_rows(n)),
+                                     Rcpp::Named("ppos_int_ratio_gt1") = arma::vec(r.ppos_int_ratio_gt1.head(n)),
+                                     Rcpp::Named("ppos_max_ratio_gt1") = arma::vec(r.ppos_max_ratio_gt1.head(n)),
+                                     Rcpp::Named("n_draw") = n);
 
  return ret;
 }
@@ -833,85 +1062,78 @@ Rcpp::List rcpp_clin_set_state(arma::mat& d, const int look,
 
 
 
-// immunological endpoint
 
 
 
 // [[Rcpp::export]]
-Rcpp::List rcpp_immu(const arma::mat& d, const Rcpp::List& cfg,
-                     const int look){
-
- Rcpp::NumericVector looks_target = cfg["looks_target"];
- Rcpp::NumericVector looks = cfg["looks"];
- Rcpp::NumericVector months = cfg["interimmnths"];
- arma::mat m = arma::zeros((int)cfg["post_draw"] , 3);
- int mylook = look - 1;
- int nimpute1 = 0;
- int nimpute2 = 0;
- double ppos_n = 0;
- double ppos_max = 0;
- Rcpp::List lnsero;
- Rcpp::List pp1;
- Rcpp::List pp2;
- Rcpp::List ret;
+Rcpp::List rcpp_clin_set_state(arma::mat& d, const int look,
+                              const double fu,
+                              const Rcpp::List& cfg, const int idxsim){
+ TrialData td = trial_from_mat(d);
+ ClinSuffStat lss = sim_clin_set_state(td, look, fu, read_cfg(cfg));
+ trial_state_to_mat(td, d);
+ return lss_to_list(lss);
+}
 
- if(looks[mylook] <= (int)cfg["nmaxsero"]){
 
-   // how many records did we observe in total (assumes balance)
-   int nobs = rcpp_n_obs(d, look, looks, months, (float)cfg["sero_info_delay"]);
+// [[Rcpp::export]]
+Rcpp::List rcpp_clin_suffstat(const arma::mat& d, const int look,
+                             const double fu,
+                             const Rcpp::List& cfg){
+ TrialData td = trial_from_mat(d);
+ return lss_to_list(sim_clin_suffstat(td, look, fu, read_cfg(cfg)));
+}
 
-   // how many successes in each arm?
-   lnsero = rcpp_lnsero(d, nobs);
 
-   // posterior at this interim
-   arma::mat m = arma::zeros((int)cfg["post_draw"] , 3);
-   rcpp_immu_interim_post(d, m, nobs, (int)cfg["post_draw"], lnsero);
+// one ClinTally taken through looks in the order given, as a trial does
+// from its first clin look. the state is written back to d as at the
+// last look, the suff stats of every look are returned in a list.
+// [[Rcpp::export]]
+Rcpp::List rcpp_clin_tally(arma::mat& d, const Rcpp::IntegerVector& looks,
+                          const Rcpp::List& cfg){
+ SimConfig c = read_cfg(cfg);
+ TrialData td = trial_from_mat(d);
+ ClinTally tally;
+ Rcpp::List ret(looks.size());
+ for(int k = 0; k < looks.size(); k++){
+   if(looks[k] < 1 || looks[k] > c.nlooks()){
+     Rcpp::stop("look out of range");
+   }
+   ret[k] = lss_to_list(tally.update(td, looks[k], c));
+ }
+ trial_state_to_mat(td, d);
+ return ret;
+}
 
-   // therefore how many do we need to impute assuming that we
-   // were enrolling at the 50 per interim rate?
-   nimpute1 = looks_target[mylook] - nobs;
 
-   // if nimpute > 0 then do the ppos calc
-   double post1gt0 = 0;
-   if(nimpute1 > 0){
-     // predicted prob of success at interim
-     pp1 = rcpp_immu_ppos_test(d, m, look, nobs, nimpute1,(int)cfg["post_draw"],lnsero, cfg);
-   } else {
-     // else compute the posterior prob that delta > 0
-     arma::uvec tmp = arma::find(m.col(COL_DELTA) > 0);
-     post1gt0 = (double)tmp.n_elem / (double)cfg["post_draw"];
-   }
 
-   // predicted prob of success at nmaxsero
-   // if nimpute2 == 0 then we are at nmaxsero with no information delay so just report
-   // the posterior prob that delta is gt 0 (post1gt0) which has already been computed above.
-   nimpute2 = (int)cfg["nmaxsero"] - nobs;
-   if(nimpute2 > 0){
-     pp2 = rcpp_immu_ppos_test(d, m, look, nobs, nimpute2, (int)cfg["post_draw"],lnsero, cfg);
-   }
 
+// immunological endpoint
 
-   // assess posterior
-   double mean_delta =  arma::mean(m.col(COL_DELTA));
-   double sd_delta =  arma::stddev(m.col(COL_DELTA));
-   double lwr = mean_delta - 1.96 * sd_delta;
-   double upr = mean_delta + 1.96 * sd_delta;
-   mean_delta = round(mean_delta * 1000) / 1000;
-   lwr = round(lwr * 1000) / 1000;
-   upr = round(upr * 1000) / 1000;
 
 
+// [[Rcpp::export]]
+Rcpp::List rcpp_immu(const arma::mat& d, const Rcpp::List& cfg,
+                     const int look){
 
-   ret = Rcpp::List::create(Rcpp::Named("ppos_n") = nimpute1 > 0 ? (double)pp1["ppos"] : post1gt0,
-                            Rcpp::Named("ppos_max") = nimpute2 > 0 ? (double)pp2["ppos"] : post1gt0,
-                            Rcpp::Named("nimpute1") = nimpute1,
-                            Rcpp::Named("nimpute2") = nimpute2,
-                            Rcpp::Named("delta") = mean_delta,
-                            Rcpp::Named("lwr") = lwr,
-                            Rcpp::Named("upr") = upr,
-                            Rcpp::Named("n_sero_ctl") = (int)lnsero["n_sero_ctl"],
-                            Rcpp::Named("n_sero_trt") = (int)lnsero["n_sero_trt"]);
+ SimConfig c = read_cfg(cfg);
+ SeroTally tally;
+ Workspace ws;
+ ws.fit(c);
+ ImmuRes r = sim_immu(trial_from_mat(d), c, look, rng_from_r(), tally, ws);
+ Rcpp::List ret;
 
+ if(r.done){
+   ret = Rcpp::List::create(Rcpp::Named("ppos_n") = r.ppos_n,
+                            Rcpp::Named("ppos_max") = r.ppos_max,
+                            Rcpp::Named("nimpute1") = r.nimpute1,
+                            Rcpp::Named("nimpute2") = r.nimpute2,
+                            Rcpp::Named("delta") = r.delta,
+                            Rcpp::Named("lwr") = r.lwr,
+                            Rcpp::Named("upr") = r.upr,
+                            Rcpp::Named("n_sero_ctl") = r.n_sero_ctl,
+                            Rcpp::Named("n_sero_trt") = r.n_sero_trt,
+                            Rcpp::Named("n_draw") = r.n_draw);
  }
 
  return ret;
@@ -924,71 +1146,14 @@ int rcpp_n_obs(const arma::mat& d,
               const Rcpp::NumericVector looks,
               const Rcpp::NumericVector months,
               const double info_delay){
-
- // set look to zero (first element of array)
- int mylook = look - 1;
- double obs_to_month = months[mylook] - info_delay;
- int nobs = 0;
- int flooraccrt = 0;
- float fudge = 0.0001;
-
- for(int i = 0; i < d.n_rows; i++){
-
-   // have to fudge to work around inexact numeric representation :(
-   flooraccrt = floor(d(i, COL_ACCRT) + info_delay);
-   if(flooraccrt == months[mylook] && i%2 == 1){
-     // we accrue ctl/trt pairs simultaneously.
-     nobs = i + 1 ;
-     DBG(Rcpp::Rcout, "(Equal to) ID " << d(i, COL_ID) << " ACCRT "
-                                       << d(i, COL_ACCRT) << " at i = "
-                                       << i << " nobs = " << nobs);
-     break;
-   }
-
-
-   if(d(i, COL_ACCRT) + info_delay > months[mylook] + fudge  && i%2 == 0){
-     // we accrue ctl/trt pairs simultaneously.
-     nobs = i ;
-     // DBG(Rcpp::Rcout, "(Greater than) ID " << d(i, COL_ID) << " ACCRT "
-     //                                          << d(i, COL_ACCRT) << " at i = "
-     //                                          << i << " nobs = " << nobs);
-     break;
-   }
-
- }
- return nobs;
+ return sim_n_obs(trial_from_mat(d), look, Rcpp::as< std::vector<double> >(months), info_delay);
 }
 
 
 // [[Rcpp::export]]
 Rcpp::List rcpp_lnsero(const arma::mat& d,
                       const int nobs){
-
- int n_sero_ctl = 0;
- int n_sero_trt = 0;
-
- // todo have now discovered this can probably be done with arma::find
- for(int i = 0; i < nobs; i++){
-
-   if(d(i, COL_TRT) == 0){
-     n_sero_ctl = n_sero_ctl + d(i, COL_SEROT3);
-   } else {
-     n_sero_trt = n_sero_trt + d(i, COL_SEROT3);
-   }
- }
-
- //DBG(Rcpp::Rcout, "nobs " << nobs);
- //DBG(Rcpp::Rcout, "n_sero_ctl " << n_sero_ctl);
- //DBG(Rcpp::Rcout, "n_sero_trt " << n_sero_trt);
-
- Rcpp::List l = Rcpp::List::create(Rcpp::Named("n_sero_ctl") = n_sero_ctl,
-                                   Rcpp::Named("n_sero_trt") = n_sero_trt);
-
- //Rcpp::List l = Rcpp::List::create(n_sero_ctl, n_sero_trt);
-
- //DBG(Rcpp::Rcout, "lnsero " << l);
-
- return l;
+ return lnsero_to_list(sim_lnsero(trial_from_mat(d), nobs));
 }
 
 
@@ -998,15 +1163,8 @@ void rcpp_immu_interim_post(const arma::mat& d,
                            const int nobs,
                            const int post_draw,
                            const Rcpp::List& lnsero){
-
- for(int i = 0; i < post_draw; i++){
-   m(i, COL_THETA0) = R::rbeta(1 + (int)lnsero["n_sero_ctl"], 1 + (nobs/2) - (int)lnsero["n_sero_ctl"]);
-   m(i, COL_THETA1) = R::rbeta(1 + (int)lnsero["n_sero_trt"], 1 + (nobs/2) - (int)lnsero["n_sero_trt"]);
-   m(i, COL_DELTA) = m(i, COL_THETA1) - m(i, COL_THETA0);
- }
-
- return;
-
+ sim_immu_interim_post(m, nobs, post_draw, lnsero_from_list(lnsero),
+                       rng_from_r().stream(STREAM_USER, 0), PP_MC_PLAIN);
 }
 
 
@@ -1024,38 +1182,30 @@ Rcpp::List rcpp_immu_interim_ppos(const arma::mat& d,
  int n_sero_ctl = 0;
  int n_sero_trt = 0;
  int win = 0;
- arma::vec t0 = arma::zeros(post_draw);
- arma::vec t1 = arma::zeros(post_draw);
- arma::vec delta1 = arma::zeros(post_draw);
  arma::vec postprobdelta_gt0 = arma::zeros(post_draw);
 
  Rcpp::NumericVector post_sero_win_thresh = cfg["post_sero_win_thresh"];
 
- arma::vec n_gt0 = arma::zeros(post_draw);
-
  int ntarget = nobs + nimpute;
+ int base_ctl = (int)lnsero["n_sero_ctl"];
+ int base_trt = (int)lnsero["n_sero_trt"];
+ std::vector<double> memo;
+ SeroProbTable pgt0(ntarget/2, base_ctl, base_trt, nimpute/2, memo);
+ Rng rng = rng_from_r().stream(STREAM_USER, 0);
 
  // create 1000 phony interims conditional on our current understanding
  // of theta0 and theta1.
  for(int i = 0; i < post_draw; i++){
 
-   // This is a view of the total draws at a sample size of nobs + nimpute
-   n_sero_ctl = lnsero["n_sero_ctl"] + R::rbinom((nimpute/2), m(i, COL_THETA0));
-   n_sero_trt = lnsero["n_sero_trt"] + R::rbinom((nimpute/2), m(i, COL_THETA1));
-
-   // update the posteriors
-   for(int j = 0; j < post_draw; j++){
-
-     t0(j) = R::rbeta(1 + n_sero_ctl, 1 + (ntarget/2) - n_sero_ctl);
-     t1(j) = R::rbeta(1 + n_sero_trt, 1 + (ntarget/2) - n_sero_trt);
+   Rng r = rng.substream(i);
 
-     delta1(j) = t1(j) - t0(j);
-   }
+   // This is a view of the total draws at a sample size of nobs + nimpute
+   n_sero_ctl = base_ctl + r.rbinom((nimpute/2), m(i, COL_THETA0));
+   n_sero_trt = base_trt + r.rbinom((nimpute/2), m(i, COL_THETA1));
 
-   // empirical posterior probability that ratio_lamb > 1
-   arma::uvec tmp = arma::find(delta1 > 0);
-   n_gt0(i) = (double)tmp.n_elem;
-   postprobdelta_gt0(i) =  (double)tmp.n_elem / (double)post_draw;
+   // exact posterior probability that delta > 0, this was previously
+   // estimated from post_draw pairs of beta draws
+   postprobdelta_gt0(i) = pgt0(n_sero_ctl, n_sero_trt);
    if(postprobdelta_gt0(i) > post_sero_win_thresh[mylook]){
      win++;
    }
@@ -1086,60 +1236,23 @@ Rcpp::List rcpp_immu_ppos_test(const arma::mat& d,
                               const Rcpp::List& lnsero,
                               const Rcpp::List& cfg){
 
- int mylook = look - 1;
- int n_sero_ctl = 0;
- int n_sero_trt = 0;
- int win = 0;
- arma::vec t0 = arma::zeros(post_draw);
- arma::vec t1 = arma::zeros(post_draw);
- arma::vec delta1 = arma::zeros(post_draw);
- arma::vec postprobdelta_gt0 = arma::zeros(post_draw);
-
- Rcpp::NumericVector post_sero_win_thresh = cfg["post_sero_win_thresh"];
-
- arma::vec n_gt0 = arma::zeros(post_draw);
-
- int ntarget = nobs + nimpute;
-
- // create 1000 phony interims conditional on our current understanding
- // of theta0 and theta1.
- for(int i = 0; i < post_draw; i++){
-
-   // This is a view of the total draws at a sample size of nobs + nimpute
-   n_sero_ctl = lnsero["n_sero_ctl"] + R::rbinom((nimpute/2), m(i, COL_THETA0));
-   n_sero_trt = lnsero["n_sero_trt"] + R::rbinom((nimpute/2), m(i, COL_THETA1));
-
-   double a = n_sero_trt;
-   double b = 1 + (ntarget/2) - n_sero_trt;
-
-   double c = n_sero_ctl;
-   double d = 1 + (ntarget/2) - n_sero_ctl;
-
-   double m1 = a / (a + b);
-   double v1 = a*b / (std::pow(a + b, 2.0) * (a + b + 1));
-
-   double m2 = c / (c + d);
-   double v2 = c*d / (std::pow(c + d, 2.0) * (c + d + 1));
-
-   double z = (m1 - m2) / pow(v1 + v2, 0.5);
-
-   postprobdelta_gt0(i) = R::pnorm(z, 0.0, 1.0, 1, 0);
-
-   if(postprobdelta_gt0(i) > post_sero_win_thresh[mylook]){
-     win++;
-   }
- }
-
- double ppos = (double)win / (double)post_draw;
-
- DBG(Rcpp::Rcout, "immu pp impute " << nimpute << " num win " << win << " ppos " << ppos <<
-   " post thresh for win " << post_sero_win_thresh[mylook] );
-
- Rcpp::List res = Rcpp::List::create(Rcpp::Named("ppos") = ppos,
-                                     Rcpp::Named("postprobdelta_gt0") = postprobdelta_gt0);
+ // no decision to settle so pp_adaptive has no effect here. post_draw
+ // need not be the config's so size the draws from the argument.
+ SimConfig c = read_cfg(cfg);
+ c.post_draw = post_draw;
+ Workspace ws;
+ ws.fit(c);
+ PposRes& r = ws.pp[0];
+ sim_immu_ppos_test(m, look, nobs, nimpute, post_draw,
+                    lnsero_from_list(lnsero), c,
+                    rng_from_r().stream(STREAM_USER, 0), NA_REAL, r, ws);
+
+ Rcpp::List res = Rcpp::List::create(Rcpp::Named("ppos") = r.ppos,
+                                     Rcpp::Named("postprobdelta_gt0") =
+                                       arma::vec(r.postprobdelta_gt0.head(r.n_draw)),
+                                     Rcpp::Named("n_draw") = r.n_draw);
 
  return res;
-
 }
 
 
@@ -1165,99 +1278,44 @@ Rcpp::List rcpp_logrank(const arma::mat& d,
 
  int mylook = look - 1;
  Rcpp::NumericVector looks = cfg["looks"];
- Rcpp::NumericVector months = cfg["interimmnths"];
-
- arma::mat d_new = d.submat(0, COL_ID, looks[mylook]-1, COL_OBST);
- //DBG(Rcpp::Rcout, "  submatrix " << std::endl << d_new );
-
- // all observation time indices by group
- arma::uvec idxz1 = arma::find(d_new.col(COL_TRT) == 0);
- arma::uvec idxz2 = arma::find(d_new.col(COL_TRT) == 1);
-
- //DBG(Rcpp::Rcout, " idxz1 " <<  idxz1 );
- //DBG(Rcpp::Rcout, " idxz2 " <<  idxz2 );
-
- arma::vec tmp = d_new.col(COL_OBST);
- //DBG(Rcpp::Rcout, " tmp " <<  tmp );
-
- arma::vec z1 = tmp.elem(idxz1);
- arma::vec z2 = tmp.elem(idxz2);
-
- // uncensored observation time indices by group
- idxz1 = arma::find(d_new.col(COL_TRT) == 0 && d_new.col(COL_CEN) == 0);
- idxz2 = arma::find(d_new.col(COL_TRT) == 1 && d_new.col(COL_CEN) == 0);
-
- arma::vec t1 = tmp.elem(idxz1);
- arma::vec t2 = tmp.elem(idxz2);
-
- //DBG(Rcpp::Rcout, " z1 " << z1);
- //DBG(Rcpp::Rcout, " z2 " << z2);
- //DBG(Rcpp::Rcout, " t1 " << t1);
- //DBG(Rcpp::Rcout, " t2 " << t2);
-
- arma::mat z1t1 = arma::zeros(z1.n_elem, t1.n_elem);
- arma::mat z1t2 = arma::zeros(z1.n_elem, t2.n_elem);
- arma::mat z2t1 = arma::zeros(z2.n_elem, t1.n_elem);
- arma::mat z2t2 = arma::zeros(z2.n_elem, t2.n_elem);
-
- //DBG(Rcpp::Rcout, " rcpp_outer " );
- rcpp_outer(z1, t1, z1t1);
- rcpp_outer(z1, t2, z1t2);
- rcpp_outer(z2, t1, z2t1);
- rcpp_outer(z2, t2, z2t2);
-
- //DBG(Rcpp::Rcout, " cumsum " );
- arma::vec risk1t1 = arma::sum(z1t1.t(), 1);
- arma::vec risk1t2 = arma::sum(z1t2.t(), 1);
- arma::vec risk2t1 = arma::sum(z2t1.t(), 1);
- arma::vec risk2t2 = arma::sum(z2t2.t(), 1);
-
- // DBG(Rcpp::Rcout, " risk1t1 " << risk1t1);
- // DBG(Rcpp::Rcout, " risk1t2 " << risk1t2);
- // DBG(Rcpp::Rcout, " risk2t1 " << risk2t1);
- // DBG(Rcpp::Rcout, " risk2t2 " << risk2t2);
-
- double sum1 = 0;
- double sum2 = 0;
- double var1 = 0;
- double var2 = 0;
-
- for(int i=0; i < risk1t1.n_elem; i++){
-   sum1 += risk2t1(i) / (risk1t1(i) + risk2t1(i));
-   var1 += risk1t1(i) * risk2t1(i) / std::pow((risk1t1(i) + risk2t1(i)), 2.0);
- }
- for(int i=0; i < risk1t2.n_elem; i++){
-   sum2 += risk1t2(i) / (risk1t2(i) + risk2t2(i));
-   var2 += risk1t2(i) * risk2t2(i) / std::pow((risk1t2(i) + risk2t2(i)), 2.0);
- }
 
- // DBG(Rcpp::Rcout, " sum1 " << sum1 );
- // DBG(Rcpp::Rcout, " sum2 " << sum2 );
- // DBG(Rcpp::Rcout, " var1 " << var1 );
- // DBG(Rcpp::Rcout, " var2 " << var2 );
- //
- // DBG(Rcpp::Rcout, " (sum1 - sum2) " << (sum1 - sum2) );
- // DBG(Rcpp::Rcout, " std::pow(var1 + var2, 0.5) " << std::pow(var1 + var2, 0.5) );
-
- double logrank = (sum1 - sum2)/std::pow(var1 + var2, 0.5);
+ LogrankStat st = sim_logrank(trial_from_mat(d), (int)looks[mylook],
+                              std::vector<int>());
+ double logrank = st.z();
  double pvalue = R::pchisq(std::pow(logrank, 2), 1, 0, 0);
 
- //DBG(Rcpp::Rcout, " z1 " << std::endl << z1 );
- //DBG(Rcpp::Rcout, " z2 " << std::endl << z2 );
+ Rcpp::List res = Rcpp::List::create(Rcpp::Named("logrank") = logrank,
+                                     Rcpp::Named("pvalue") = pvalue );
 
- //DBG(Rcpp::Rcout, " col of submatrix " << std::endl << d_new.col(COL_TRT)  );
+ return res;
 
- // z1 = d2$obst[d2$trt == 0],
- // delta1 = 1-d2$cen[d2$trt == 0],
+}
 
- // z2 = d2$obst[d2$trt == 1],
- // delta2 = 1-d2$cen[d2$trt == 1])
+
+// stratified by strata (one integer per row of d, e.g. the baseline
+// serostatus)
+// [[Rcpp::export]]
+Rcpp::List rcpp_logrank_strat(const arma::mat& d,
+                             const int look,
+                             const Rcpp::IntegerVector& strata,
+                             const Rcpp::List& cfg){
+
+ int mylook = look - 1;
+ Rcpp::NumericVector looks = cfg["looks"];
+ int n = (int)looks[mylook];
+ if(strata.size() < n){
+   Rcpp::stop("strata must have an entry for each of the first looks[look] rows");
+ }
+
+ LogrankStat st = sim_logrank(trial_from_mat(d), n,
+                              Rcpp::as< std::vector<int> >(strata));
+ double logrank = st.z();
+ double pvalue = R::pchisq(std::pow(logrank, 2), 1, 0, 0);
 
  Rcpp::List res = Rcpp::List::create(Rcpp::Named("logrank") = logrank,
                                      Rcpp::Named("pvalue") = pvalue );
 
  return res;
-
 }
 
 
@@ -1266,9 +1324,10 @@ Rcpp::List rcpp_logrank(const arma::mat& d,
 arma::vec rcpp_gamma(const int n, const double a, const double b) {
 
  arma::vec v = arma::zeros(n);
+ Rng rng = rng_from_r().stream(STREAM_USER, 0);
 
  for(int i = 0; i < n; i++){
-   v(i) = R::rgamma(a, b);
+   v(i) = rng.rgamma(a, b);
  }
 
  return v;
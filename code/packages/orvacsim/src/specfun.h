@@ -0,0 +1,324 @@
+#ifndef ORVACSIM_SPECFUN_H
+#define ORVACSIM_SPECFUN_H
+
+// special functions for the closed form posterior probabilities and the
+// inverse cdf samplers of the predictive draws (qmc.h). R-free
+// and reentrant (std::lgamma may write the global signgam) so that they
+// can be called from the trial workers.
+
+#include <cmath>
+#include <algorithm>
+
+// log gamma for x > 0, lanczos approximation (g = 7, n = 9), good to
+// around 1e-15 relative.
+inline double lgamma_pos(double x){
+ static const double cof[9] = {
+   0.99999999999980993, 676.5203681218851, -1259.1392167224028,
+   771.32342877765313, -176.61502916214059, 12.507343278686905,
+   -0.13857109526572012, 9.9843695780195716e-6, 1.5056327351493116e-7
+ };
+ if(x < 0.5){
+   // gamma(x) = gamma(x + 1) / x
+   return lgamma_pos(x + 1) - std::log(x);
+ }
+ x -= 1;
+ double s = cof[0];
+ for(int i = 1; i < 9; i++){
+   s += cof[i] / (x + i);
+ }
+ double t = x + 7.5;
+ return 0.91893853320467274 + (x + 0.5) * std::log(t) - t + std::log(s);
+}
+
+inline double lbeta(const double a, const double b){
+ return lgamma_pos(a) + lgamma_pos(b) - lgamma_pos(a + b);
+}
+
+// continued fraction for the incomplete beta, modified lentz
+inline double ibeta_cf(const double x, const double a, const double b){
+ const double tiny = 1e-300;
+ const double eps = 1e-15;
+ double qab = a + b;
+ double qap = a + 1;
+ double qam = a - 1;
+ double c = 1;
+ double d = 1 - qab * x / qap;
+ if(std::fabs(d) < tiny) d = tiny;
+ d = 1 / d;
+ double h = d;
+ for(int m = 1; m <= 10000; m++){
+   int m2 = 2 * m;
+   double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+   d = 1 + aa * d;
+   if(std::fabs(d) < tiny) d = tiny;
+   c = 1 + aa / c;
+   if(std::fabs(c) < tiny) c = tiny;
+   d = 1 / d;
+   h *= d * c;
+   aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+   d = 1 + aa * d;
+   if(std::fabs(d) < tiny) d = tiny;
+   c = 1 + aa / c;
+   if(std::fabs(c) < tiny) c = tiny;
+   d = 1 / d;
+   double del = d * c;
+   h *= del;
+   if(std::fabs(del - 1) < eps) break;
+ }
+ return h;
+}
+
+// regularised incomplete beta I_x(a, b), i.e. the Beta(a, b) cdf at x
+inline double pbeta_reg(const double x, const double a, const double b){
+ if(x <= 0) return 0;
+ if(x >= 1) return 1;
+ double lfront = a * std::log(x) + b * std::log1p(-x) - lbeta(a, b);
+ // the fraction converges quickly for x < (a + 1) / (a + b + 2), use the
+ // symmetry I_x(a, b) = 1 - I_1-x(b, a) otherwise
+ if(x < (a + 1) / (a + b + 2)){
+   return std::exp(lfront) * ibeta_cf(x, a, b) / a;
+ }
+ return 1 - std::exp(lfront) * ibeta_cf(1 - x, b, a) / b;
+}
+
+// regularised lower incomplete gamma P(a, x), i.e. the gamma(a, scale 1)
+// cdf at x. series below a + 1, continued fraction (modified lentz) above.
+inline double pgamma_reg(const double x, const double a){
+ if(x <= 0) return 0;
+ const double tiny = 1e-300;
+ const double eps = 1e-15;
+ double lfront = a * std::log(x) - x - lgamma_pos(a);
+ if(x < a + 1){
+   double ap = a;
+   double del = 1 / a;
+   double sum = del;
+   for(int n = 0; n < 10000; n++){
+     ap += 1;
+     del *= x / ap;
+     sum += del;
+     if(std::fabs(del) < std::fabs(sum) * eps) break;
+   }
+   return sum * std::exp(lfront);
+ }
+ double b = x + 1 - a;
+ double c = 1 / tiny;
+ double d = 1 / b;
+ double h = d;
+ for(int i = 1; i <= 10000; i++){
+   double an = -i * (i - a);
+   b += 2;
+   d = an * d + b;
+   if(std::fabs(d) < tiny) d = tiny;
+   c = b + an / c;
+   if(std::fabs(c) < tiny) c = tiny;
+   d = 1 / d;
+   double del = d * c;
+   h *= del;
+   if(std::fabs(del - 1) < eps) break;
+ }
+ return 1 - std::exp(lfront) * h;
+}
+
+// standard normal quantile, acklam's rational approximation (relative
+// error 1e-9) polished by one halley step on erfc.
+inline double qnorm_std(const double p){
+ static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                             -2.759285104469687e+02, 1.383577518672690e+02,
+                             -3.066479806614716e+01, 2.506628277459239e+00};
+ static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                             -1.556989798598866e+02, 6.680131188771972e+01,
+                             -1.328068155288572e+01};
+ static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                             -2.400758277161838e+00, -2.549732539343734e+00,
+                             4.374664141464968e+00, 2.938163982698783e+00};
+ static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01,
+                             2.445134137142996e+00, 3.754408661907416e+00};
+ double x;
+ if(p < 0.02425){
+   double q = std::sqrt(-2 * std::log(p));
+   x = (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+     ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+ } else if(p <= 1 - 0.02425){
+   double q = p - 0.5;
+   double r = q * q;
+   x = (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5]) * q /
+     (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+ } else {
+   double q = std::sqrt(-2 * std::log1p(-p));
+   x = -(((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+     ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+ }
+ double e = 0.5 * std::erfc(-x / std::sqrt(2.0)) - p;
+ double u = e * std::sqrt(2 * M_PI) * std::exp(0.5 * x * x);
+ return x - u / (1 + 0.5 * x * u);
+}
+
+// gamma(a, scale 1) quantile by halley steps on pgamma_reg from the
+// numerical recipes starting values (wilson-hilferty for a > 1).
+inline double qgamma_std(const double p, const double a){
+ if(p <= 0) return 0;
+ const double eps = 1e-12;
+ double a1 = a - 1;
+ double gln = lgamma_pos(a);
+ double lna1 = 0;
+ double afac = 0;
+ double x;
+ if(a > 1){
+   lna1 = std::log(a1);
+   afac = std::exp(a1 * (lna1 - 1) - gln);
+   double z = qnorm_std(p);
+   x = a * std::pow(1 - 1 / (9 * a) + z / (3 * std::sqrt(a)), 3);
+   if(x < 1e-3) x = 1e-3;
+ } else {
+   double t = 1 - a * (0.253 + a * 0.12);
+   x = p < t ? std::pow(p / t, 1 / a) : 1 - std::log(1 - (p - t) / (1 - t));
+ }
+ // bracketed as in qbeta_reg, hi stays infinite until a step overshoots
+ double lo = 0;
+ double hi = INFINITY;
+ for(int j = 0; j < 200; j++){
+   double err = pgamma_reg(x, a) - p;
+   if(err < 0) lo = x; else hi = x;
+   double t = a > 1 ? afac * std::exp(-(x - a1) + a1 * (std::log(x) - lna1))
+                    : std::exp(-x + a1 * std::log(x) - gln);
+   double xn;
+   if(t > 0 && std::isfinite(t)){
+     double u = err / t;
+     xn = x - u / (1 - 0.5 * std::min(1.0, u * (a1 / x - 1)));
+   } else {
+     xn = NAN;
+   }
+   if(!(xn > lo && xn < hi)) xn = std::isfinite(hi) ? 0.5 * (lo + hi) : 2 * x;
+   bool done = std::fabs(xn - x) < eps * x;
+   x = xn;
+   if(done) break;
+ }
+ return x;
+}
+
+// beta(a, b) quantile by halley steps on pbeta_reg from the numerical
+// recipes starting values.
+inline double qbeta_reg(const double p, const double a, const double b){
+ if(p <= 0) return 0;
+ if(p >= 1) return 1;
+ const double eps = 1e-12;
+ double a1 = a - 1;
+ double b1 = b - 1;
+ double x;
+ if(a >= 1 && b >= 1){
+   double z = -qnorm_std(p);
+   double al = (z * z - 3) / 6;
+   double h = 2 / (1 / (2 * a - 1) + 1 / (2 * b - 1));
+   double w = (z * std::sqrt(al + h) / h) -
+     (1 / (2 * b - 1) - 1 / (2 * a - 1)) * (al + 5.0 / 6 - 2 / (3 * h));
+   x = a / (a + b * std::exp(2 * w));
+ } else {
+   double lna = std::log(a / (a + b));
+   double lnb = std::log(b / (a + b));
+   double t = std::exp(a * lna) / a;
+   double u = std::exp(b * lnb) / b;
+   double w = t + u;
+   x = p < t / w ? std::pow(a * w * p, 1 / a) : 1 - std::pow(b * w * (1 - p), 1 / b);
+ }
+ // the steps are kept inside a bracket on the root, bisecting when one
+ // would leave it
+ double lo = 0;
+ double hi = 1;
+ if(!(x > lo && x < hi)) x = 0.5;
+ double afac = -lbeta(a, b);
+ for(int j = 0; j < 200; j++){
+   double err = pbeta_reg(x, a, b) - p;
+   if(err < 0) lo = x; else hi = x;
+   double t = std::exp(a1 * std::log(x) + b1 * std::log1p(-x) + afac);
+   double u = err / t;
+   double xn = x - u / (1 - 0.5 * std::min(1.0, u * (a1 / x - b1 / (1 - x))));
+   if(!(xn > lo && xn < hi)) xn = 0.5 * (lo + hi);
+   bool done = std::fabs(xn - x) < eps * x;
+   x = xn;
+   if(done) break;
+ }
+ return x;
+}
+
+// binomial(n, p) quantile, the smallest k with P(X <= k) >= u. starts
+// from the mode with the cdf from the incomplete beta and walks, so the
+// cost is of order the sd rather than n.
+inline int qbinom_inv(const double u, const int n, const double p){
+ if(n <= 0 || p <= 0) return 0;
+ if(p >= 1) return n;
+ double q = 1 - p;
+ int k = (int)std::floor((n + 1) * p);
+ if(k > n) k = n;
+ double f = std::exp(lgamma_pos(n + 1.0) - lgamma_pos(k + 1.0) - lgamma_pos(n - k + 1.0) +
+                     k * std::log(p) + (n - k) * std::log(q));
+ // P(X <= k) = I_q(n - k, k + 1)
+ double cdf = k == n ? 1 : pbeta_reg(q, n - k, k + 1.0);
+ if(u <= cdf){
+   while(k > 0 && u <= cdf - f){
+     cdf -= f;
+     f *= k / (n - k + 1.0) * q / p;
+     k--;
+   }
+ } else {
+   while(k < n && u > cdf){
+     f *= (n - k) / (k + 1.0) * p / q;
+     k++;
+     cdf += f;
+   }
+ }
+ return k;
+}
+
+// P(lambda0 / lambda1 > 1) for independent lambda0 ~ gamma(a0, rate = b0)
+// and lambda1 ~ gamma(a1, rate = b1). with x = b0 lambda0, y = b1 lambda1,
+// x / (x + y) ~ beta(a0, a1) and lambda0 > lambda1 iff that exceeds
+// b0 / (b0 + b1).
+inline double prob_gamma_ratio_gt1(const double a0, const double b0,
+                                   const double a1, const double b1){
+ // 1 - I_w(a0, a1) == I_1-w(a1, a0), avoids the cancellation
+ return pbeta_reg(b1 / (b0 + b1), a1, a0);
+}
+
+// P(X1 > X0) for independent X1 ~ beta(a1, b1) and X0 ~ beta(a0, b0) where
+// a1 is a positive integer. the sum is from cook (2005)
+//   sum_{i < a1} B(a0 + i, b0 + b1) / ((b1 + i) B(1 + i, b1) B(a0, b0))
+// with the terms built by recurrence so only the first needs lgamma.
+inline double prob_beta_gt_int(const double a1, const double b1,
+                               const double a0, const double b0){
+ int n = (int)a1;
+ double t = std::exp(lbeta(a0, b0 + b1) - lbeta(a0, b0));
+ double p = t;
+ for(int i = 0; i < n - 1; i++){
+   t *= (a0 + i) * (b1 + i) / ((a0 + b0 + b1 + i) * (1 + i));
+   p += t;
+ }
+ return p;
+}
+
+// P(X1 > X0), at least one of a1, a0 must be a positive integer. sums
+// over whichever shape is the smaller integer.
+inline double prob_beta_gt(const double a1, const double b1,
+                           const double a0, const double b0){
+ bool int1 = a1 == std::floor(a1) && a1 >= 1;
+ bool int0 = a0 == std::floor(a0) && a0 >= 1;
+ if(int1 && (!int0 || a1 <= a0)){
+   return prob_beta_gt_int(a1, b1, a0, b0);
+ }
+ return 1 - prob_beta_gt_int(a0, b0, a1, b1);
+}
+
+// beta-binomial pmf for y = 0..n, i.e. the posterior predictive count of
+// n future binomial trials under a beta(a, b) posterior. out is resized
+// to n + 1.
+template <typename Vec>
+inline void dbetabinom_all(const int n, const double a, const double b, Vec& out){
+ out.resize(n + 1);
+ double p = std::exp(lbeta(a, n + b) - lbeta(a, b));
+ out[0] = p;
+ for(int y = 0; y < n; y++){
+   p *= (double)(n - y) / (y + 1) * (y + a) / (n - y - 1 + b);
+   out[y + 1] = p;
+ }
+}
+
+#endif
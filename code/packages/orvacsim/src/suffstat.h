@@ -0,0 +1,153 @@
+#ifndef ORVACSIM_SUFFSTAT_H
+#define ORVACSIM_SUFFSTAT_H
+
+// censoring and sufficient stats for one arm without per-subject state.
+//
+// the predictive draws in sim_clin only need the event count and total
+// exposure, so this skips the reason/impute/obst write back done by
+// sim_clin_set_state and evaluates the four censoring cases with selects
+// instead of branches. x86 builds get an avx2 version chosen at run time;
+// everything else, and cpus without avx2, use the scalar version. both
+// sum exposure over the same four lanes in the same order so results do
+// not depend on which one ran (sim_clin_set_state uses lane_sum for the
+// same reason).
+
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ORVACSIM_HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+struct ArmSuffStat {
+ int n_evnt;
+ double tot_obst;
+};
+
+// sum of x[0..n) accumulated over four lanes then the tail, the order
+// used by the kernels below.
+inline double lane_sum(const double* x, const int n){
+ double lane[4] = {0, 0, 0, 0};
+ int j = 0;
+ for(; j + 4 <= n; j += 4){
+   for(int k = 0; k < 4; k++){
+     lane[k] += x[j+k];
+   }
+ }
+ double tot = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+ for(; j < n; j++){
+   tot += x[j];
+ }
+ return tot;
+}
+
+// exposure for one subject, see sim_clin_set_state for the four cases
+inline double subj_obst(const double accrt, const double age, const double evtt,
+                        const double mon, const double fu, const double max_age_fu,
+                        int& evnt){
+ double reftime = mon;
+ if(fu != 0){
+   double r = fu - age + accrt;
+   reftime = r > mon ? r : mon;
+ }
+ bool obs = accrt + evtt <= reftime;
+ bool within = age + evtt <= max_age_fu;
+ evnt = obs && within;
+ double o = max_age_fu - age;
+ if(!obs && reftime - accrt <= max_age_fu - age) o = reftime - accrt;
+ if(obs && within) o = evtt;
+ return o;
+}
+
+inline ArmSuffStat arm_suffstat_scalar(const double* accrt, const double* age,
+                                       const double* evtt, const int n,
+                                       const double mon, const double fu,
+                                       const double max_age_fu){
+ double lane[4] = {0, 0, 0, 0};
+ int n_evnt = 0;
+ int e = 0;
+ int j = 0;
+ for(; j + 4 <= n; j += 4){
+   for(int k = 0; k < 4; k++){
+     lane[k] += subj_obst(accrt[j+k], age[j+k], evtt[j+k], mon, fu, max_age_fu, e);
+     n_evnt += e;
+   }
+ }
+ double tot = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+ for(; j < n; j++){
+   tot += subj_obst(accrt[j], age[j], evtt[j], mon, fu, max_age_fu, e);
+   n_evnt += e;
+ }
+ ArmSuffStat s = {n_evnt, tot};
+ return s;
+}
+
+#ifdef ORVACSIM_HAVE_AVX2_KERNEL
+
+__attribute__((target("avx2")))
+inline ArmSuffStat arm_suffstat_avx2(const double* accrt, const double* age,
+                                     const double* evtt, const int n,
+                                     const double mon, const double fu,
+                                     const double max_age_fu){
+ const __m256d vmon = _mm256_set1_pd(mon);
+ const __m256d vfu = _mm256_set1_pd(fu);
+ const __m256d vmax = _mm256_set1_pd(max_age_fu);
+ __m256d sum = _mm256_setzero_pd();
+ int n_evnt = 0;
+ int j = 0;
+ for(; j + 4 <= n; j += 4){
+   __m256d acc = _mm256_loadu_pd(accrt + j);
+   __m256d ag = _mm256_loadu_pd(age + j);
+   __m256d ev = _mm256_loadu_pd(evtt + j);
+   __m256d ref = vmon;
+   if(fu != 0){
+     ref = _mm256_max_pd(_mm256_add_pd(_mm256_sub_pd(vfu, ag), acc), vmon);
+   }
+   __m256d obs = _mm256_cmp_pd(_mm256_add_pd(acc, ev), ref, _CMP_LE_OQ);
+   __m256d within = _mm256_cmp_pd(_mm256_add_pd(ag, ev), vmax, _CMP_LE_OQ);
+   __m256d evnt = _mm256_and_pd(obs, within);
+   __m256d cen_max = _mm256_sub_pd(vmax, ag);
+   __m256d cen_ref = _mm256_sub_pd(ref, acc);
+   __m256d use_ref = _mm256_andnot_pd(obs, _mm256_cmp_pd(cen_ref, cen_max, _CMP_LE_OQ));
+   __m256d o = _mm256_blendv_pd(cen_max, cen_ref, use_ref);
+   o = _mm256_blendv_pd(o, ev, evnt);
+   sum = _mm256_add_pd(sum, o);
+   n_evnt += __builtin_popcount(_mm256_movemask_pd(evnt));
+ }
+ double lane[4];
+ _mm256_storeu_pd(lane, sum);
+ double tot = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+ int e = 0;
+ for(; j < n; j++){
+   tot += subj_obst(accrt[j], age[j], evtt[j], mon, fu, max_age_fu, e);
+   n_evnt += e;
+ }
+ ArmSuffStat s = {n_evnt, tot};
+ return s;
+}
+
+inline bool cpu_has_avx2(){
+ static const bool has = [](){
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2") != 0;
+ }();
+ return has;
+}
+
+#endif
+
+// event count and total exposure for the first n subjects of an arm at
+// the look with month mon, fu as for sim_clin_set_state.
+inline ArmSuffStat arm_suffstat(const double* accrt, const double* age,
+                                const double* evtt, const int n,
+                                const double mon, const double fu,
+                                const double max_age_fu){
+#ifdef ORVACSIM_HAVE_AVX2_KERNEL
+ if(cpu_has_avx2()){
+   return arm_suffstat_avx2(accrt, age, evtt, n, mon, fu, max_age_fu);
+ }
+#endif
+ return arm_suffstat_scalar(accrt, age, evtt, n, mon, fu, max_age_fu);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef ORVACSIM_TRACEFILE_H
+#define ORVACSIM_TRACEFILE_H
+
+// per look analysis trace of simulated trials, kept so that the stopping
+// rules can be replayed without simulating again. every look of a trial
+// is one fixed size LookStat record:
+//
+//   header   "ORVTRC02" | uint32 record size | uint32 seed | uint64 cfg hash
+//            | int32 nmaxsero | uint32 nlooks | nlooks x int32 looks
+//   records  nlooks x LookStat per trial, looks in order
+//
+// host byte order, as written by fwrite. the cfg hash is
+// SimConfig::result_hash(false), which leaves out the rules a replay may
+// change. R-free.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// what the stopping rules and the trial summary use from the analyses at
+// one look. the final analyses are those the trial runs if it stops at
+// this look (immu: if this is its last immu look). the flags say which
+// analyses have been run. laid out without padding so a record can be
+// written as is.
+struct LookStat {
+ int32_t idxsim = 0;
+ int32_t look = 0;
+ int32_t immu = 0;
+ int32_t clin = 0;
+ int32_t i_fin = 0;
+ int32_t c_fin = 0;
+ int32_t nobs = 0;          // sero results in by the look
+ int32_t n_sero_ctl = 0;
+ int32_t n_sero_trt = 0;
+ int32_t n_evnt_0 = 0;      // events and exposure at the clin interim
+ int32_t n_evnt_1 = 0;
+ int32_t i_draws = 0;       // predictive draws used, 0 when not sampled
+ int32_t c_draws = 0;
+ int32_t f_nobs = 0;        // sero results in by the look without delay
+ int32_t f_sero_ctl = 0;    // and their seroconversions, for i_post
+ int32_t f_sero_trt = 0;
+ double tot_obst_0 = 0;
+ double tot_obst_1 = 0;
+ double i_ppn = 0;
+ double i_ppmax = 0;
+ double c_ppn = 0;          // ppn_win
+ double c_ppmax = 0;        // ppmax_win
+ double i_post = 0;         // P(delta > 0)
+ double i_mean = 0;
+ double i_lwr = 0;
+ double i_upr = 0;
+ double c_post = 0;         // P(ratio > 1)
+ double c_mean = 0;
+ double c_lwr = 0;
+ double c_upr = 0;
+};
+
+static_assert(sizeof(LookStat) == 16 * 4 + 14 * 8, "LookStat has padding");
+
+// the parts of the cfg the trace depends on that the replay checks
+struct TraceHeader {
+ uint32_t seed = 0;
+ uint64_t cfg = 0;
+ int32_t nmaxsero = 0;
+ std::vector<int32_t> looks;
+};
+
+namespace tracefile {
+
+static const char magic[8] = {'O', 'R', 'V', 'T', 'R', 'C', '0', '2'};
+
+inline void fail(const std::string& path, const std::string& msg){
+ throw std::runtime_error("trace file " + path + ": " + msg);
+}
+
+}
+
+// writes the header on construction and a trial's looks with add()
+class TraceWriter {
+private:
+ std::string path;
+ FILE* f = nullptr;
+
+public:
+ TraceWriter(const std::string& path, const TraceHeader& h) : path(path) {
+   f = std::fopen(path.c_str(), "wb");
+   if(!f) tracefile::fail(path, "cannot create");
+   uint32_t rsize = sizeof(LookStat);
+   uint32_t nlooks = (uint32_t)h.looks.size();
+   std::fwrite(tracefile::magic, 1, 8, f);
+   std::fwrite(&rsize, sizeof(rsize), 1, f);
+   std::fwrite(&h.seed, sizeof(h.seed), 1, f);
+   std::fwrite(&h.cfg, sizeof(h.cfg), 1, f);
+   std::fwrite(&h.nmaxsero, sizeof(h.nmaxsero), 1, f);
+   std::fwrite(&nlooks, sizeof(nlooks), 1, f);
+   std::fwrite(h.looks.data(), sizeof(int32_t), nlooks, f);
+ }
+
+ ~TraceWriter(){
+   if(f) std::fclose(f);
+ }
+
+ TraceWriter(const TraceWriter&) = delete;
+ TraceWriter& operator=(const TraceWriter&) = delete;
+
+ void add(const std::vector<LookStat>& st){
+   if(std::fwrite(st.data(), sizeof(LookStat), st.size(), f) != st.size()){
+     tracefile::fail(path, "write failed");
+   }
+ }
+
+ // closes the file, throws if anything failed to reach it
+ void close(){
+   bool bad = std::fflush(f) != 0 || std::ferror(f);
+   std::fclose(f);
+   f = nullptr;
+   if(bad) tracefile::fail(path, "write failed");
+ }
+};
+
+// header and every complete trial in the file
+inline std::vector<LookStat> trace_read(const std::string& path, TraceHeader& h){
+
+ FILE* f = std::fopen(path.c_str(), "rb");
+ if(!f) tracefile::fail(path, "cannot open");
+
+ char m[8];
+ uint32_t rsize = 0;
+ uint32_t nlooks = 0;
+ bool ok = std::fread(m, 1, 8, f) == 8 && std::memcmp(m, tracefile::magic, 8) == 0 &&
+   std::fread(&rsize, sizeof(rsize), 1, f) == 1 && rsize == sizeof(LookStat) &&
+   std::fread(&h.seed, sizeof(h.seed), 1, f) == 1 &&
+   std::fread(&h.cfg, sizeof(h.cfg), 1, f) == 1 &&
+   std::fread(&h.nmaxsero, sizeof(h.nmaxsero), 1, f) == 1 &&
+   std::fread(&nlooks, sizeof(nlooks), 1, f) == 1 && nlooks > 0 && nlooks < 100000;
+ if(ok){
+   h.looks.resize(nlooks);
+   ok = std::fread(h.looks.data(), sizeof(int32_t), nlooks, f) == nlooks;
+ }
+ if(!ok){
+   std::fclose(f);
+   tracefile::fail(path, "not a trace file from this build");
+ }
+
+ std::vector<LookStat> st;
+ std::vector<LookStat> trial(nlooks);
+ while(std::fread(trial.data(), sizeof(LookStat), nlooks, f) == nlooks){
+   st.insert(st.end(), trial.begin(), trial.end());
+ }
+ std::fclose(f);
+ return st;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef ORVACSIM_TRIALDATA_H
+#define ORVACSIM_TRIALDATA_H
+
+// subject level trial data, stored by arm as struct of arrays.
+//
+// subjects alternate between arms as they enrol so the first k enrolled
+// are a prefix of each arm's arrays. the censoring and sufficient stat
+// sweeps therefore run over contiguous, branch free (no trt test) ranges.
+// flags are uint8 with STATE_NA for not yet set, times are NaN until set.
+// the R facing matrix with the COL_* layout is only built when asked for
+// (see trial_to_mat).
+//
+// a simulated trial enrols its whole cohort up front but only the first
+// n_out have outcomes (serot2, serot3, evtt), see sim_dat_outcomes.
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#define ARM_CTL           0
+#define ARM_TRT           1
+#define STATE_NA          255
+// resolution of the accrual index, times are compared as whole ticks
+#define TICKS_PER_MONTH   1000000.0
+
+// one arm, in order of enrolment
+struct ArmData {
+ std::vector<int> id;            // 1 based subject id, row in the R matrix
+ std::vector<double> accrt;
+ std::vector<double> age;
+ std::vector<double> evtt;
+ std::vector<uint8_t> serot2;
+ std::vector<uint8_t> serot3;
+
+ // state as of the last clin_set_state
+ std::vector<uint8_t> cen;
+ std::vector<uint8_t> reason;
+ std::vector<uint8_t> impute;
+ std::vector<double> obst;
+ std::vector<double> reftime;
+
+ int size() const { return (int)id.size(); }
+
+ void reserve(const int n){
+   id.reserve(n); accrt.reserve(n); age.reserve(n); evtt.reserve(n);
+   serot2.reserve(n); serot3.reserve(n);
+   cen.reserve(n); reason.reserve(n); impute.reserve(n);
+   obst.reserve(n); reftime.reserve(n);
+ }
+
+ // empty, keeping the capacity
+ void clear(){
+   id.clear(); accrt.clear(); age.clear(); evtt.clear();
+   serot2.clear(); serot3.clear();
+   cen.clear(); reason.clear(); impute.clear();
+   obst.clear(); reftime.clear();
+ }
+};
+
+struct TrialData {
+ ArmData arm[2];
+
+ // by enrolment order, arm and position within the arm
+ std::vector<uint8_t> trt;
+ std::vector<int> pos;
+ // nctl[k] is the number of controls among the first k enrolled
+ std::vector<int> nctl;
+ // accrual time of each ctl/trt pair (enrolment 2p, 2p + 1) in ticks,
+ // non-decreasing. built by index_accrual once the accrual times are set.
+ std::vector<int64_t> pair_tick;
+
+ // the first n_out enrolled have their outcomes, the rest are 0
+ int n_out = 0;
+
+ // constant across subjects
+ double probt3_trt = 0;
+ double fu1 = 0;
+ double fu2 = 0;
+
+ int size() const { return (int)trt.size(); }
+
+ void reserve(const int n){
+   arm[0].reserve(n/2 + 1);
+   arm[1].reserve(n/2 + 1);
+   trt.reserve(n);
+   pos.reserve(n);
+   nctl.reserve(n + 1);
+   pair_tick.reserve((n + 1) / 2);
+ }
+
+ // empty, keeping the capacity so a reused TrialData does not allocate
+ void clear(){
+   arm[0].clear();
+   arm[1].clear();
+   trt.clear();
+   pos.clear();
+   nctl.clear();
+   pair_tick.clear();
+   n_out = 0;
+   probt3_trt = 0;
+   fu1 = 0;
+   fu2 = 0;
+ }
+
+ // number of the first k enrolled that are in arm a
+ int n_in_arm(const int a, const int k) const {
+   return a == ARM_CTL ? nctl[k] : k - nctl[k];
+ }
+
+ double accrt(const int i) const { return arm[trt[i]].accrt[pos[i]]; }
+
+ // appends subject i (0 based enrolment index) to arm a, the caller
+ // fills the per arm values.
+ int add(const int a){
+   int p = arm[a].size();
+   trt.push_back((uint8_t)a);
+   pos.push_back(p);
+   if(nctl.empty()) nctl.push_back(0);
+   nctl.push_back(nctl.back() + (a == ARM_CTL ? 1 : 0));
+   ArmData& s = arm[a];
+   s.id.push_back(size());
+   s.accrt.push_back(0);
+   s.age.push_back(0);
+   s.evtt.push_back(0);
+   s.serot2.push_back(0);
+   s.serot3.push_back(0);
+   s.cen.push_back(STATE_NA);
+   s.reason.push_back(STATE_NA);
+   s.impute.push_back(STATE_NA);
+   s.obst.push_back(std::numeric_limits<double>::quiet_NaN());
+   s.reftime.push_back(std::numeric_limits<double>::quiet_NaN());
+   return p;
+ }
+
+ static int64_t to_tick(const double t){
+   return (int64_t)std::llround(t * TICKS_PER_MONTH);
+ }
+
+ void index_accrual(){
+   pair_tick.clear();
+   pair_tick.reserve((size() + 1) / 2);
+   for(int i = 0; i < size(); i += 2){
+     pair_tick.push_back(to_tick(accrt(i)));
+   }
+ }
+
+ // number enrolled whose results are in by month given the delay from
+ // accrual, i.e. the pairs with accrual + delay <= month. rounding each
+ // time to the tick grid first makes the comparison exact, an accrual
+ // time like 70 * 0.1 is not taken to be after month 7.
+ int n_obs_by(const double month, const double delay) const {
+   int64_t last = to_tick(month) - to_tick(delay);
+   int npair = (int)(std::upper_bound(pair_tick.begin(), pair_tick.end(), last)
+                     - pair_tick.begin());
+   return std::min(2 * npair, size());
+ }
+
+ // forget censoring state ahead of a fresh clin_set_state
+ void clear_cen_obst(){
+   for(int a = 0; a < 2; a++){
+     std::vector<uint8_t>& c = arm[a].cen;
+     for(int j = 0; j < (int)c.size(); j++){
+       c[j] = STATE_NA;
+     }
+     arm[a].obst.assign(arm[a].obst.size(),
+                        std::numeric_limits<double>::quiet_NaN());
+   }
+ }
+};
+
+#endif